@@ -0,0 +1,107 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "cache.h"
+
+InvariantCache::InvariantCache(const std::string& fname) {
+    std::ifstream in(fname);
+    std::string line;
+    bool torn = false;
+    while (std::getline(in, line)) {
+        // A last line with no newline was cut short by a crash or a full
+        // disk, so its value may be incomplete.
+        if (in.eof()) {
+            torn = true;
+            break;
+        }
+        // The key is everything up to the second tab, and an entry has no
+        // more tabs than that.
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos)
+            tab = line.find('\t', tab + 1);
+        if (tab == std::string::npos ||
+                line.find('\t', tab + 1) != std::string::npos)
+            continue;
+        values[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+    fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    // End the torn line, so that our first entry is not glued onto it. The
+    // two tabs make sure it never reads as a valid entry, however much of it
+    // was written.
+    if (fd >= 0 && torn && ::write(fd, "\t\t\n", 3) != 3) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+InvariantCache::~InvariantCache() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool InvariantCache::ok() const {
+    return fd >= 0;
+}
+
+bool InvariantCache::find(const std::string& sig, const std::string& invariant,
+        std::string& value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = values.find(sig + '\t' + invariant);
+    if (it == values.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+void InvariantCache::store(const std::string& sig, const std::string& invariant,
+        const std::string& value) {
+    std::string key = sig + '\t' + invariant;
+    std::string line = key + '\t' + value + '\n';
+    std::lock_guard<std::mutex> lock(mutex);
+    values[key] = value;
+    // A single write to a file opened with O_APPEND, so lines from other
+    // processes sharing the cache do not get mixed up with ours.
+    if (fd >= 0 &&
+            ::write(fd, line.data(), line.size()) != (ssize_t) line.size()) {
+        std::cerr << "Error: Could not update invariant cache: "
+            << strerror(errno) << std::endl;
+        close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,74 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * An on-disk cache of invariant values, keyed on the isomorphism signature of
+ * a triangulation and the name of the invariant.
+ *
+ * The cache file holds one tab-separated line "<sig> <invariant> <value>" per
+ * entry. It is read in full on construction, and every new entry is appended
+ * to it straight away, so later runs (and other threads in this run) can use
+ * it. It is safe to share an InvariantCache between threads.
+ *
+ * A last line with no newline (cut short by a crash or a full disk) is
+ * ignored, and so is any line that does not have exactly two tabs.
+ */
+class InvariantCache {
+    public:
+        InvariantCache(const std::string& fname);
+        ~InvariantCache();
+
+        // Whether the cache file could be opened.
+        bool ok() const;
+
+        // Look up the given invariant of sig, returning true and setting
+        // value if it is known.
+        bool find(const std::string& sig, const std::string& invariant,
+                std::string& value);
+
+        // Record the value of the given invariant of sig.
+        void store(const std::string& sig, const std::string& invariant,
+                const std::string& value);
+
+    private:
+        std::unordered_map<std::string, std::string> values;
+        std::mutex mutex;
+        int fd;
+};
+
+#endif // _CACHE_H
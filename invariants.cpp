@@ -0,0 +1,298 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <algebra/nhomologicaldata.h>
+#include <treewidth/treedecomposition.h>
+
+#include "invariants.h"
+#include "tv.h"
+
+using namespace regina;
+
+// The Turaev-Viro log, if we have one, which is guarded by tvLogMutex once
+// it is open.
+static std::ofstream tvLog;
+static std::mutex tvLogMutex;
+
+bool log_turaev_viro(const std::string& fname, bool append) {
+    tvLog.open(fname, append ? std::ios::app : std::ios::trunc);
+    return tvLog.good();
+}
+
+// Rough number of edges per bag of a tree decomposition, relative to its
+// width plus one, for choose_algorithm().
+static const double TREEWIDTH_EDGES_PER_BAG = 3.0;
+
+// Regina can compute Turaev-Viro invariants by backtracking through the
+// admissible colourings of the edges, or by dynamic programming over a tree
+// decomposition of the dual graph. Backtracking takes time roughly (r-1) to
+// the power of the number of edges, and dynamic programming roughly the
+// number of tetrahedra times (r-1) to the power of the number of edges
+// meeting a bag. Choose whichever looks faster; the constants can be tuned
+// using the Turaev-Viro log.
+static Algorithm choose_algorithm(const NTriangulation& tri, unsigned long r,
+        int width) {
+    double backtrack = tri.countEdges();
+    double treewidth = TREEWIDTH_EDGES_PER_BAG * (width + 1) +
+        std::log(tri.size()) / std::log(r - 1);
+    return (backtrack <= treewidth) ? ALG_BACKTRACK : ALG_TREEWIDTH;
+}
+
+// Whether to check native Turaev-Viro values against regina's.
+static bool checkNative = false;
+
+void check_native_turaev_viro() {
+    checkNative = true;
+}
+
+// The name of alg in the Turaev-Viro log.
+static const char* algorithm_name(Algorithm alg) {
+    return (alg == ALG_BACKTRACK) ? "backtrack" : "treewidth";
+}
+
+// Note a Turaev-Viro computation that started at start in the log.
+static void log_turaev_viro(const NTriangulation& tri, unsigned long r,
+        bool parity, const char* kind, int width, const char* alg,
+        std::chrono::steady_clock::time_point start) {
+    if (! tvLog.is_open())
+        return;
+    std::chrono::duration<double> taken =
+        std::chrono::steady_clock::now() - start;
+    std::string sig = tri.isoSig();
+    std::lock_guard<std::mutex> lock(tvLogMutex);
+    tvLog << sig << '\t' << r << '\t' << (parity ? "true" : "false") << '\t'
+        << kind << '\t' << width << '\t' << alg << '\t' << taken.count()
+        << std::endl;
+}
+
+// The Turaev-Viro invariant for r and parity, as in Regina.
+static Invariant turaev_viro(unsigned long r, bool parity) {
+    std::stringstream id;
+    id << "tv(" << r << "," << (parity ? "true" : "false") << ")";
+    return Invariant{ id.str(), 100.0 * std::pow(r, 4),
+        [r, parity](const NTriangulation& tri, ProgressTracker* tracker) {
+            int width = TreeDecomposition(tri).width();
+            Algorithm alg = choose_algorithm(tri, r, width);
+            auto start = std::chrono::steady_clock::now();
+            std::stringstream s;
+            s << tri.turaevViro(r, parity, alg, tracker);
+            log_turaev_viro(tri, r, parity,
+                    (tracker && tracker->isCancelled()) ? "cancelled" : "exact",
+                    width, algorithm_name(alg), start);
+            return s.str();
+        },
+        // Regina's exact invariant with the given parity is the complex
+        // value at e^(i pi/r) if parity is true, or e^(2 i pi/r) if not.
+        // We use our own evaluation where we can, as it is faster and bounds
+        // its own rounding error. Regina's gives no such bound, so without
+        // ours there is no approximation worth having.
+        [r, parity](const NTriangulation& tri, double& error) {
+            unsigned long root = parity ? 1 : 2;
+            auto start = std::chrono::steady_clock::now();
+            double value;
+            int width;
+            bool native = turaev_viro_native(tri, r, root, value, &width,
+                    &error);
+            if (native) {
+                log_turaev_viro(tri, r, parity, "approx", width, "native",
+                        start);
+                if (! checkNative)
+                    return value;
+            } else if (! checkNative) {
+                error = HUGE_VAL;
+                return 0.0;
+            }
+            width = TreeDecomposition(tri).width();
+            Algorithm alg = choose_algorithm(tri, r, width);
+            start = std::chrono::steady_clock::now();
+            double regina = tri.turaevViroApprox(r, root, alg);
+            log_turaev_viro(tri, r, parity, "approx", width,
+                    algorithm_name(alg), start);
+            if (native && std::fabs(value - regina) >
+                    1e-9 * std::max(1.0, std::fabs(regina)))
+                std::cerr << "Error: Native Turaev-Viro invariant ("
+                    << r << ", " << (parity ? "true" : "false") << ") of "
+                    << tri.isoSig() << " is " << value << " but regina gives "
+                    << regina << "." << std::endl;
+            error = native ? error + std::fabs(value - regina) : HUGE_VAL;
+            return regina;
+        }, true };
+}
+
+// Every invariant other than the Turaev-Viro invariants. Note that things
+// like edge degree sequences, which depend on the triangulation and not just
+// the manifold, cannot go here.
+static const std::vector<Invariant>& fixed_invariants() {
+    static const std::vector<Invariant> fixed = {
+        { "orbl", 1, [](const NTriangulation& tri, ProgressTracker*) {
+            return std::string(tri.isOrientable() ? "orbl" : "nor");
+        }, nullptr, false },
+        { "homology", 10, [](const NTriangulation& tri, ProgressTracker*) {
+            return tri.homology().str();
+        }, nullptr, false },
+        { "h2z2", 10, [](const NTriangulation& tri, ProgressTracker*) {
+            std::stringstream s;
+            s << tri.homologyH2Z2();
+            return s.str();
+        }, nullptr, false },
+        // The torsion linking form is only defined for orientable manifolds.
+        { "linking", 50, [](const NTriangulation& tri, ProgressTracker*) {
+            if (! tri.isOrientable())
+                return std::string("-");
+            NHomologicalData data(tri);
+            return data.torsionRankVectorString() + " " +
+                data.torsionSigmaVectorString() + " " +
+                data.torsionLegendreSymbolVectorString();
+        }, nullptr, false },
+    };
+    return fixed;
+}
+
+bool compute_within(const Invariant& inv, const NTriangulation& tri,
+        double seconds, std::string& value) {
+    // Only an invariant that polls the tracker can be stopped, so there is
+    // no point watching any other.
+    if (seconds <= 0 || ! inv.cancellable) {
+        value = inv.compute(tri, 0);
+        return true;
+    }
+    // A watchdog cancels the computation if it is still going when time is
+    // up.
+    ProgressTracker tracker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool finished = false;
+    std::thread watchdog([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (! cv.wait_for(lock, std::chrono::duration<double>(seconds),
+                    [&] { return finished; }))
+            tracker.cancel();
+    });
+    value = inv.compute(tri, &tracker);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished = true;
+    }
+    cv.notify_one();
+    watchdog.join();
+    return ! tracker.isCancelled();
+}
+
+bool find_invariant(const std::string& id, Invariant& inv) {
+    for (auto& f: fixed_invariants())
+        if (f.id == id) {
+            inv = f;
+            return true;
+        }
+    unsigned long r;
+    char parity[6];
+    int used = 0;
+    if (sscanf(id.c_str(), "tv(%lu,%5[a-z])%n", &r, parity, &used) == 2 &&
+            used == (int) id.length() && r >= 3) {
+        // Regina only defines the invariant with parity false for odd r.
+        std::string p(parity);
+        if (p == "true" || (p == "false" && r % 2 == 1)) {
+            inv = turaev_viro(r, p == "true");
+            return true;
+        }
+    }
+    return false;
+}
+
+void list_invariants(std::ostream& out) {
+    for (auto& f: fixed_invariants())
+        out << f.id << "\tcost " << f.cost << std::endl;
+    out << "tv(r,true), or tv(r,false) for odd r\tcost 100*r^4" << std::endl;
+}
+
+InvariantChain::InvariantChain() : custom(false) {
+}
+
+bool InvariantChain::parse(const std::string& spec) {
+    std::vector<Invariant> chain;
+    // Split on commas, but not those inside the brackets of tv(r,parity).
+    int depth = 0;
+    std::string id;
+    for (size_t i = 0; i <= spec.length(); ++i) {
+        char c = (i < spec.length()) ? spec[i] : ',';
+        if (i == spec.length() && depth != 0)
+            return false;
+        if (c == ',' && depth == 0) {
+            Invariant inv;
+            if (! find_invariant(id, inv))
+                return false;
+            chain.push_back(inv);
+            id.clear();
+            continue;
+        }
+        if (c == '(')
+            ++depth;
+        else if (c == ')')
+            --depth;
+        id += c;
+    }
+    invariants = chain;
+    custom = true;
+    return true;
+}
+
+bool InvariantChain::at(size_t index, Invariant& inv) const {
+    if (custom) {
+        if (index >= invariants.size())
+            return false;
+        inv = invariants[index];
+        return true;
+    }
+    if (index < 2) {
+        inv = fixed_invariants()[index];
+        return true;
+    }
+    int a = index % 3;
+    int b = index / 3;
+    if ( a == 0 )
+        inv = turaev_viro(2*b+1, false);
+    else if ( a == 1 )
+        inv = turaev_viro(2*b+2, true);
+    else // a == 2
+        inv = turaev_viro(2*b+3, true);
+    return true;
+}
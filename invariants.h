@@ -0,0 +1,121 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _INVARIANTS_H
+#define _INVARIANTS_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <progress/progresstracker.h>
+#include <triangulation/ntriangulation.h>
+
+/**
+ * A 3-manifold invariant which can be added to a profile. The id names the
+ * invariant on the command line and in the invariant cache, and cost is a
+ * rough guide to how expensive it is to compute, relative to orientability.
+ *
+ * Every invariant must give the same value for any two triangulations of the
+ * same manifold, or components of one manifold could be put in different
+ * partitions and never be joined.
+ *
+ * Invariants that can take a long time should give up if the tracker (which
+ * may be null) is cancelled, and set cancellable; what they return in that
+ * case is ignored. Other invariants always run to the end.
+ *
+ * Some invariants also have a much cheaper floating point approximation (if
+ * not, approx is empty), which also sets its second argument to a bound on
+ * how far the approximation can be from the true value (HUGE_VAL if there is
+ * no such bound). Approximations that are further apart than their bounds
+ * allow prove the invariants differ, but close ones prove nothing.
+ */
+struct Invariant {
+    std::string id;
+    double cost;
+    std::function<std::string(const regina::NTriangulation&,
+            regina::ProgressTracker*)> compute;
+    std::function<double(const regina::NTriangulation&, double&)> approx;
+    bool cancellable;
+};
+
+// Compute inv for tri, giving up after the given number of seconds (if this
+// is positive and inv is cancellable). Returns false if we gave up.
+bool compute_within(const Invariant& inv, const regina::NTriangulation& tri,
+        double seconds, std::string& value);
+
+// Log every Turaev-Viro computation to the given file as a line of
+// tab-separated signature, r, parity, "exact", "approx" or "cancelled", the
+// treewidth found, the algorithm chosen and the time taken in seconds. This
+// must be called before any invariants are computed. Returns false if the
+// file cannot be opened.
+bool log_turaev_viro(const std::string& fname, bool append);
+
+// Compute every approximate Turaev-Viro invariant with regina as well as
+// natively (see tv.h), reporting any difference on stderr and using regina's
+// value, with the difference added to the error bound. This must be called
+// before any invariants are computed.
+void check_native_turaev_viro();
+
+// Find the invariant with the given id, returning false if there is none.
+bool find_invariant(const std::string& id, Invariant& inv);
+
+// Describe every invariant we know of, with its cost, for --invariants=list.
+void list_invariants(std::ostream& out);
+
+/**
+ * The invariants used to build profiles: position i of every profile holds
+ * the value of invariant i of the chain.
+ *
+ * By default this is orientability, homology, then the Turaev-Viro invariants
+ * in order of increasing r, that is TV(3, true), TV(3, false), TV(4, true),
+ * TV(5, true), TV(5, false), TV(6, true) and so on without end.
+ */
+class InvariantChain {
+    public:
+        InvariantChain();
+
+        // Use the comma-separated list of invariant ids in spec instead of
+        // the default chain. Returns false, and leaves the chain alone, if
+        // spec names an invariant we do not know.
+        bool parse(const std::string& spec);
+
+        // Set inv to the invariant at position index, returning false if
+        // the chain is not that long.
+        bool at(size_t index, Invariant& inv) const;
+
+    private:
+        bool custom;
+        std::vector<Invariant> invariants;
+};
+
+#endif // _INVARIANTS_H
@@ -32,16 +32,74 @@
 /**
  * Usage:
  *
- * sortcensus <mode> <levels> <input-dir> <output-dir>
+ * sortcensus [options] <mode> <levels> <input-dir> <output-dir>
  *
  * mode is either -i (invariants) or -p (Pachner moves)
  * levels is an integer, stating how many invariants to add/how many levels of
  * the Pachner graph to explore
  * <input-dir> is a directory containing .sigs files, each of which will be
- * processed
+ * processed. It may also contain .pack files, in which case each .sigs file
+ * in the pack is processed as if it were a separate file.
  * <output-dir> should already exist, and is where each output file will be
  * placed.
  *
+ * Output files are written atomically, and each input file is recorded in
+ * <output-dir>/sortcensus.journal once all of its output is on disk. The
+ * options are:
+ * -j <threads>: process this many files (and invariants) at once. The default
+ *   is the number of CPUs this process may use, going by its CPU affinity and
+ *   any cgroup CPU quota, and can also be set with the environment variable
+ *   SORTCENSUS_THREADS.
+ * --resume: skip input files already recorded in the journal by an earlier
+ *   (interrupted) run with the same arguments.
+ * --pack: rather than writing many (small) files, put all output into
+ *   <output-dir>/sortcensus-0.pack (or the next unused number, if resuming).
+ *   A run without --resume will not start if later packs from an earlier
+ *   run are still there.
+ * --reps[=K]: only write the minimal triangulation of each component, then
+ *   up to K (by default 0) other members, then a hash and the number of
+ *   triangulations in the component.
+ * --stats: next to each output file foo.sigs, write foo.stats.json giving
+ *   maxN and, for each profile, the number of components, a histogram of
+ *   their sizes, the number of components that were resolved (shrank below
+ *   maxN tetrahedra, which only happens with -p) and the length of the
+ *   queue (null if there is no queue).
+ * --cache <file>: keep every invariant computed in <file>, and use the values
+ *   already there rather than computing them again. The same file can be
+ *   used by any number of runs.
+ * --invariants <list>: add the given comma-separated invariants to profiles,
+ *   in that order, rather than the default sequence above. Cheap invariants
+ *   such as homology and the torsion linking form ("linking") can then be
+ *   used before any Turaev-Viro invariant, written tv(r,true) or (for odd r
+ *   only) tv(r,false). --invariants=list prints every invariant along with a
+ *   rough cost.
+ * --timeout <seconds>: give up on any single Turaev-Viro invariant (the
+ *   only invariants that can be stopped part way) that takes longer than
+ *   this. The invariant is written as "?" in the profile, for that
+ *   component and every component it could not be told apart from, and the
+ *   signature and invariant are listed in <output-dir>/timeouts.txt.
+ * --approx: first compute a floating point approximation of invariants which
+ *   have one (the Turaev-Viro invariants), and only compute the exact value
+ *   for components whose approximations are too close to tell apart. Other
+ *   components get the approximation, written ~value, in their profile.
+ *   Approximations are computed by our own evaluator (see tv.h), which also
+ *   bounds its rounding error, and two are only told apart if they differ
+ *   by more than their bounds allow. Where ours cannot be used, the exact
+ *   value is always computed.
+ * --check-tv: with --approx, also compute each approximation with regina,
+ *   and report any that differ from our own on stderr.
+ *
+ * Each Turaev-Viro invariant is computed with whichever of Regina's
+ * algorithms (backtracking or treewidth-based) the treewidth of the
+ * triangulation suggests will be faster. Every such computation is logged
+ * in <output-dir>/turaevviro.log, with the treewidth, the algorithm and the
+ * time taken, so the choice can be tuned.
+ *
+ * In -i mode, an input file foo.sigs is split into foo_0.sigs, foo_1.sigs and
+ * so on, one for each distinct profile, and foo_manifest.txt lists each of
+ * these files along with the number of components and signatures it holds and
+ * its profile, separated by tabs.
+ *
  * Each file (input or output) will be as follows:
  * [invariant string]
  * <list of signatures of triangulations, all connected via Pachner moves>
@@ -51,7 +109,8 @@
  * Note that both the invariant string and queue are optional, and that there
  * may be more than one space-separated list of signatures. The invariant
  * string, if present, beings with a hash (#) then a space, and contains
- * invariants common to all triangulations in the file. The invariants used are, in order:
+ * invariants common to all triangulations in the file. By default the
+ * invariants used are, in order:
  * orientability (denoted as orbl or nor)
  * homology
  * TuraevViro(3, true)
@@ -61,8 +120,13 @@
  * TuraevViro(5, false)
  * TuraevViro(6, true)
  * ...
- * and so on. The invariants are separated by semi-colons (;) and, if an
- * invariant string is present, it will always end with a semi-colon.
+ * and so on. Invariants are only added to a component's profile while it
+ * matches the profile of some other component in the same file, so profiles
+ * within a file may have different lengths. The invariants are separated by
+ * semi-colons (;) and, if an invariant string is present, it will always end
+ * with a semi-colon. A different sequence can be chosen with --invariants
+ * (see above), in which case the same sequence must be used for every -i run
+ * over the census.
  *
  * The queue begins with #q and is a space-separated list of signatures of
  * triangulations that have yet to be analysed for Pachner moves. It is assumed
@@ -72,16 +136,25 @@
  */
 
 #include <dirent.h>
+#include <getopt.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <iomanip>
 #include <map>
+#include <set>
 #include <queue>
 #include <fstream>
 #include <triangulation/ntriangulation.h>
 
+#include "cache.h"
+#include "invariants.h"
 #include "threadpool.h"
+#include "writer.h"
 
 using namespace regina;
 
@@ -91,8 +164,10 @@ struct Data {
     long depth;
     long smallest;
     Data* minimal;
+    size_t id; // Scratch space for numbering nodes when writing output.
 
-    Data(const std::string& from) : sig(from), parent(0), depth(0), minimal(this) {
+    Data(const std::string& from) : sig(from), parent(0), depth(0), minimal(this),
+            id(0) {
         smallest = sig[0] - 'a';
     }
 
@@ -104,70 +179,206 @@ struct Data {
     }
 };
 
+/**
+ * The values of the invariants common to a set of triangulations, in the
+ * order they were computed.
+ *
+ * Each value is held as it is written in files. Turaev-Viro invariants come
+ * from Regina as exact cyclotomic field elements, so equal invariants always
+ * have equal text.
+ */
 class Profile {
     public:
-        std::string str;
-        Profile(const std::string& s) : str(s) {
-        }
+        std::vector<std::string> values;
 
-        Profile(const Profile& other) : str(other.str) {
+        // Parse a profile as written in a file, such as "# orbl;Z;".
+        // Whitespace around each value (including any carriage return at
+        // the end of the line) is ignored.
+        Profile(const std::string& s) : spaced(false) {
+            size_t pos = s.find('#') + 1;
+            spaced = (pos < s.length() && s[pos] == ' ');
+            while (pos < s.length()) {
+                size_t end = s.find(';', pos);
+                if (end == std::string::npos)
+                    end = s.length();
+                std::string value = trim(s.substr(pos, end - pos));
+                // Anything after the last semi-colon is only whitespace.
+                if (end < s.length() || ! value.empty())
+                    values.push_back(value);
+                pos = end + 1;
+            }
         }
 
-        void extend(const NTriangulation& tri) {
-            int currently_known = 0;
-            size_t s = 0;
-            // Find number of occurances of ; in string representation so far
-            while ( (s = str.find(";",s)) != std::string::npos) {
-                s+=1; // Move past the found location
-                currently_known++;
+        // The profile as written in files. A space after the hash is kept
+        // if the profile was read with one, so input is copied unchanged.
+        std::string str() const {
+            std::string ans = spaced ? "# " : "#";
+            for (auto& v: values) {
+                ans += v;
+                ans += ';';
             }
-            switch (currently_known) {
-                case 0: {
-                    bool orbl = tri.isOrientable();
-                    str += orbl ? "orbl" : "nor";
-                    break;
-                        }
-                case 1:
-                        {
-                    str += tri.homology().str();
-                    break;
-                        }
-                default:
-                        {
-                    int a = currently_known % 3;
-                    int b = currently_known / 3;
-                    std::stringstream s;
-                    if ( a == 0 )
-                        s << tri.turaevViro(2*b+1,false);
-                    else if ( a == 1 )
-                        s << tri.turaevViro(2*b+2,true);
-                    else // a == 2 {
-                        s << tri.turaevViro(2*b+3,true);
-                    str += s.str();;
-                        }
-            }
-            str += ";";
+            return ans;
         }
 
+        // Set value to inv for tri, whose signature is sig, looking it up
+        // in (and adding it to) cache if we have one. If computing it takes
+        // more than the given number of seconds (when positive), give up and
+        // return false.
+        static bool lookup(const Invariant& inv, const NTriangulation& tri,
+                const std::string& sig, InvariantCache* cache,
+                double seconds, std::string& value) {
+            if (cache && cache->find(sig, inv.id, value))
+                return true;
+            if (! compute_within(inv, tri, seconds, value))
+                return false;
+            if (cache)
+                cache->store(sig, inv.id, value);
+            return true;
+        }
 
         bool operator == (const Profile& rhs) const {
-            return str == rhs.str;
+            return values == rhs.values;
         }
 
         bool operator < (const Profile& rhs) const {
-            return str < rhs.str;
+            return values < rhs.values;
         }
 
+    private:
+        bool spaced;
+
+        static std::string trim(const std::string& s) {
+            const char* space = " \t\r\n";
+            size_t begin = s.find_first_not_of(space);
+            if (begin == std::string::npos)
+                return "";
+            return s.substr(begin, s.find_last_not_of(space) + 1 - begin);
+        }
 };
 
 std::ostream& operator << (std::ostream& out, const Profile p) {
-    return out << p.str;
+    return out << p.str();
 }
 
 typedef std::map<std::string, Data*> Graph; // For union-find.
 typedef std::map<Profile, std::vector<std::string>> Cases;
 typedef std::queue<Graph::iterator> gQueue;
 
+// The value given to an invariant that took too long to compute.
+const char* UNRESOLVED = "?";
+
+// A list of invariants that took too long to compute, so that they can be
+// dealt with separately. It is safe to share a TimeoutLog between threads.
+class TimeoutLog {
+    public:
+        TimeoutLog(const std::string& fname, bool append) :
+                out(fname, append ? std::ios::app : std::ios::trunc) {
+        }
+
+        void add(const std::string& sig, const std::string& invariant) {
+            std::lock_guard<std::mutex> lock(mutex);
+            out << sig << '\t' << invariant << std::endl;
+        }
+
+    private:
+        std::mutex mutex;
+        std::ofstream out;
+};
+
+// Things shared by every task in a run.
+struct Context {
+    ThreadPool* pool;
+    Writer* writer;
+    // If non-negative, only write each component's minimal triangulation,
+    // up to this many other members, and the size of the component.
+    int reps;
+    // Whether to write a .stats.json file alongside each .sigs file.
+    bool stats;
+    // Invariants computed in earlier runs, or null.
+    InvariantCache* cache;
+    // The invariants to add to profiles, in order.
+    const InvariantChain* chain;
+    // Whether to compare approximate invariants before exact ones.
+    bool approx;
+    // Most time to spend on any one cancellable invariant, in seconds, or 0
+    // for no limit. Invariants that take too long are noted in timeouts.
+    double timeout;
+    TimeoutLog* timeouts;
+};
+
+// Summary of one profile within an output file, for the stats sidecar.
+struct ProfileStats {
+    std::string profile;
+    size_t components;
+    std::map<size_t, size_t> sizes; // component size -> how many of them
+    size_t resolved; // components which shrank below maxN tetrahedra
+    long queue; // length of the queue, or -1 if there is none
+    ProfileStats(const std::string& p) : profile(p), components(0),
+            resolved(0), queue(-1) {
+    }
+};
+
+// Name of the stats sidecar for the output file fname.
+std::string stats_name(const std::string& fname) {
+    return fname.substr(0, fname.rfind(".sigs")) + ".stats.json";
+}
+
+std::string json_string(const std::string& s) {
+    std::string ans = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            ans += '\\';
+        ans += c;
+    }
+    return ans + "\"";
+}
+
+std::string stats_json(int maxN, const std::vector<ProfileStats>& stats) {
+    std::ostringstream out;
+    out << "{\n  \"maxN\": " << maxN << ",\n  \"profiles\": [";
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const ProfileStats& s = stats[i];
+        out << (i ? "," : "") << "\n    {\n";
+        out << "      \"profile\": " << json_string(s.profile) << ",\n";
+        out << "      \"components\": " << s.components << ",\n";
+        out << "      \"sizes\": {";
+        for (auto it = s.sizes.begin(); it != s.sizes.end(); ++it)
+            out << (it == s.sizes.begin() ? "" : ", ") << "\"" << it->first
+                << "\": " << it->second;
+        out << "},\n";
+        out << "      \"resolved\": " << s.resolved << ",\n";
+        out << "      \"queue\": ";
+        if (s.queue < 0)
+            out << "null";
+        else
+            out << s.queue;
+        out << "\n    }";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+// Write the members of a component which has n members in total, as
+// directed by reps. Returns the number of signatures written.
+template <class Iterator>
+size_t write_component(std::ostream& out, const std::string& minimal,
+        Iterator begin, Iterator end, size_t n, int reps) {
+    if (reps < 0) {
+        for (Iterator it = begin; it != end; ++it)
+            out << (it == begin ? "" : " ") << *it;
+        return n;
+    }
+    size_t written = 1;
+    out << minimal;
+    for (Iterator it = begin; it != end && written <= (size_t) reps; ++it)
+        if (*it != minimal) {
+            out << ' ' << *it;
+            ++written;
+        }
+    out << " #" << n;
+    return written;
+}
+
 Data* root(Data* n) {
     Data* ans = n;
     while (ans->parent)
@@ -217,12 +428,29 @@ bool join(Data* a, Data* b) {
 }
 
 
+// An input file, which is either a file of its own or a member of a pack.
+struct Input {
+    std::string name; // The file, or <pack>:<member>. Used in the journal.
+    std::string path; // The file or pack to read from.
+    off_t offset;     // Where in a pack the member lies,
+    off_t length;     // and its length, or -1 for a whole file.
+};
+
 // Reads input
-int read(std::string infile, Cases& waiting, std::map<Profile, Graph>& graphs,
+int read(const Input& in, Cases& waiting, std::map<Profile, Graph>& graphs,
         std::map<Profile, unsigned>& nComp) {
     int maxN = 0;
     std::string line;
-    std::ifstream inf(infile);
+    std::ifstream file(in.path, std::ios::binary);
+    std::istringstream member;
+    if (in.length >= 0) {
+        std::string buf(in.length, '\0');
+        file.seekg(in.offset);
+        file.read(&buf[0], buf.size());
+        member.str(buf);
+    }
+    std::istream& inf = (in.length >= 0) ?
+        static_cast<std::istream&>(member) : file;
     Profile p("#");
     while ( std::getline(inf, line) ) {
         std::stringstream l(line);
@@ -236,15 +464,15 @@ int read(std::string infile, Cases& waiting, std::map<Profile, Graph>& graphs,
             continue;
 
         // If we find #q, everything after this is things waiting to be
-        // processed (rather than "everything")
+        // processed (rather than "everything"). An empty list still means
+        // we know what is waiting: nothing.
         if (s == "#q") {
+            auto it = waiting.find(p);
+            if (it == waiting.end())
+                it = waiting.insert(std::make_pair(p, std::vector<std::string>())).first;
             while (l >> s) {
-                if (! s.empty()) {
-                    auto it = waiting.find(p);
-                    if (it == waiting.end())
-                        it = waiting.insert(std::make_pair(p, std::vector<std::string>())).first;
+                if (! s.empty())
                     it->second.push_back(s);
-                }
             }
             continue;
         }
@@ -265,6 +493,9 @@ int read(std::string infile, Cases& waiting, std::map<Profile, Graph>& graphs,
         it->second.insert(std::make_pair(s, d));
 
         while ( l >> s ) {
+            // A component written with --reps ends with its size.
+            if (s[0] == '#')
+                break;
             if (! s.empty()) {
                 Data *e = new Data(s);
                 join(d,e);
@@ -379,38 +610,53 @@ bool process(Data* p, Graph& graph, const Profile& prof, int maxN, gQueue &q,
     return true;
 }
 
-void dump_pachner(const std::string fname, const Profile& p, const Graph&
-        graph, int maxN, gQueue &q) {
-    typedef std::multimap<std::string, std::string> Comb;
-    Comb comps;
-
+void dump_pachner(std::ostream& out, const Profile& p, const Graph&
+        graph, int maxN, gQueue &q, int reps, ProfileStats& stats) {
+    // Number the nodes in signature order, so sorting on these numbers
+    // puts components (and the triangulations within them) in the same
+    // order as sorting on the signatures themselves.
+    std::vector<Data*> nodes;
+    nodes.reserve(graph.size());
     for (auto i = graph.begin(); i != graph.end(); ++i) {
+        i->second->id = nodes.size();
+        nodes.push_back(i->second);
+    }
+
+    // (root, node) pairs for every triangulation we will print.
+    std::vector<std::pair<size_t, size_t>> comps;
+    std::vector<bool> resolved(nodes.size(), false);
+    size_t id = 0;
+    for (auto i = graph.begin(); i != graph.end(); ++i, ++id) {
+        Data* r = root(i->second);
+        if (r->smallest < maxN && ! resolved[r->id]) {
+            resolved[r->id] = true;
+            ++stats.resolved;
+        }
         // Ignore bigger triangulations/signatures
         if (i->first[0] > 'a' + maxN)
             continue;
         // If the smallest representation has less than maxN tetrahedra, we
         // won't print any of the triangulations
-        if (root(i->second)->smallest == maxN)
-            comps.insert(std::make_pair(root(i->second)->sig, i->first));
-    }
-
-    Comb::iterator pos = comps.begin();
-    Comb::iterator prev = comps.end();
-    std::ofstream out(fname);
-    out << p << std::endl;
-    while (pos != comps.end()) {
-        if (prev == comps.end() || prev->first != pos->first) {
-            // New component.
-            if (pos != comps.begin())
-                out << '\n';
-        } else {
-            // Same component as the previous triangulation.
-            out << ' ';
-        }
-        out << pos->second;
+        if (r->smallest == maxN)
+            comps.push_back(std::make_pair(r->id, id));
+    }
+    std::sort(comps.begin(), comps.end());
 
-        prev = pos;
-        ++pos;
+    out << p << '\n';
+    std::vector<std::string> members;
+    for (size_t i = 0; i < comps.size(); ) {
+        // Gather up this component, and print it on its own line.
+        members.clear();
+        size_t end = i;
+        for ( ; end < comps.size() && comps[end].first == comps[i].first; ++end)
+            members.push_back(nodes[comps[end].second]->sig);
+        if (i > 0)
+            out << '\n';
+        write_component(out, nodes[comps[i].first]->minimal->sig,
+                members.begin(), members.end(), members.size(), reps);
+        ++stats.components;
+        ++stats.sizes[members.size()];
+        i = end;
     }
 //    if (! q.empty()) {
 //        out << std::endl << "#q";
@@ -420,15 +666,19 @@ void dump_pachner(const std::string fname, const Profile& p, const Graph&
 //            q.pop();
 //        } while (! q.empty());
 //    }
-    out << std::endl;
-    out.close();
+    out << '\n';
 }
 
-void pachner(const std::string iname, int levels, const std::string oname) {
+void pachner(const Input iname, int levels, const std::string oname,
+        const Context& ctx) {
     Cases waiting;
     std::map<Profile, Graph> graphs;
     std::map<Profile, unsigned> nComp;
     int maxN = read(iname, waiting, graphs, nComp);
+    // Every profile is appended to the one output buffer, which is handed to
+    // the writer once we are done with it.
+    std::ostringstream out;
+    std::vector<ProfileStats> stats;
     for (auto graphit = graphs.begin(); graphit != graphs.end(); ++graphit) {
         gQueue q;
         Graph& g = graphit->second;
@@ -467,15 +717,75 @@ void pachner(const std::string iname, int levels, const std::string oname) {
                      // false, which means we've shrunk this component and
                      // won't ever care about the queue again
         }
-        dump_pachner(oname, graphit->first, g, maxN, q);
+        stats.push_back(ProfileStats(graphit->first.str()));
+        // Once we have shrunk this component the queue no longer matters.
+        stats.back().queue = keepGoing ? q.size() : 0;
+        dump_pachner(out, graphit->first, g, maxN, q, ctx.reps, stats.back());
     }
+    ctx.writer->write(oname, out.str(), iname.name);
+    if (ctx.stats)
+        ctx.writer->write(stats_name(oname), stats_json(maxN, stats),
+                iname.name);
+    ctx.writer->complete(iname.name);
     free_graphs(graphs);
     return;
 }
 
-void dump_partition(const std::string fname, const Graph& graph, const
+// Wait for every task in done, then pass on the first exception any of them
+// threw. Tasks usually write into their caller's variables, so we must not
+// leave until they have all finished.
+void wait_all(std::vector<std::future<void>>& done, const Context& ctx) {
+    for (auto& d : done)
+        ctx.pool->wait(d);
+    for (auto& d : done)
+        d.get();
+}
+
+// Write a single partition file. A null pending means we have no queue at
+// all, which is not the same as an empty queue. If reps is non-negative, the
+// first member of each component must be its minimal triangulation. The
+// file is part of the output for the input unit.
+void write_partition(const std::string& unit, const std::string fname,
+        const std::string& profile,
+        const std::vector<std::vector<std::string>>& comps,
+        const std::vector<std::string>* pending, int maxN,
+        const Context& ctx) {
+    std::ostringstream out;
+    std::vector<ProfileStats> stats(1, ProfileStats(profile));
+    out << profile << '\n';
+    for (auto& comp: comps) {
+        if (ctx.reps < 0) {
+            for (auto& sig: comp)
+                out << sig << " ";
+        } else
+            write_component(out, comp[0], comp.begin(), comp.end(),
+                    comp.size(), ctx.reps);
+        out << '\n';
+        ++stats[0].components;
+        ++stats[0].sizes[comp.size()];
+    }
+    // dump the part of the queue in this partition.
+    if (pending) {
+        out << "#q";
+        for (auto& sig : *pending) {
+            out << " " << sig;
+        }
+        out << '\n';
+        stats[0].queue = pending->size();
+    }
+    ctx.writer->write(fname, out.str(), unit);
+    if (ctx.stats)
+        ctx.writer->write(stats_name(fname), stats_json(maxN, stats), unit);
+}
+
+// Partitions are numbered from count onwards, which is updated, and each one
+// gets a line in manifest. The files are part of the output for the input
+// unit.
+void dump_partition(const std::string& unit, const std::string fname,
+        const Graph& graph, const
         std::map<std::string, Profile>& profiles, const
-        std::vector<std::string> q) {
+        std::vector<std::string>* q, int maxN, int& count,
+        std::ostream& manifest, const Context& ctx) {
 
     // vector of sigs in a component
     typedef std::vector<std::string> Comp;
@@ -495,77 +805,446 @@ void dump_partition(const std::string fname, const Graph& graph, const
             it = comps.insert(std::make_pair(r->sig, Comp())).first;
         it->second.push_back(i->second->sig);
     }
+    // Move the minimal triangulation to the front of each component, leaving
+    // the other members in order.
+    if (ctx.reps >= 0) {
+        for (auto i = comps.begin(); i != comps.end(); ++i) {
+            const std::string& minimal = graph.at(i->first)->minimal->sig;
+            auto pos = std::find(i->second.begin(), i->second.end(), minimal);
+            std::rotate(i->second.begin(), pos, pos + 1);
+        }
+    }
 
     // Create partition, one for each distinct profile
     for (auto i = comps.begin(); i != comps.end(); ++i) {
         const Profile &p = profiles.at(i->first);
-        auto it = parts.find(p.str);
+        std::string key = p.str();
+        auto it = parts.find(key);
         if (it == parts.end()) {
-            it = parts.insert(std::make_pair(p.str,
+            it = parts.insert(std::make_pair(key,
                         std::vector<std::vector<std::string>>())).first;
         }
         it->second.push_back(i->second);
     }
-    int count = 0;
+
+    // Split the queue (if we have one) by partition, dropping anything not
+    // in this graph.
+    std::map<std::string, std::vector<std::string>> pending;
+    if (q) {
+        for (auto& sig : *q) {
+            auto it = graph.find(sig);
+            if (it == graph.end())
+                continue;
+            pending[profiles.at(root(it->second)->sig).str()].push_back(sig);
+        }
+    }
+
+    std::vector<std::future<void>> done;
     for (auto cit = parts.begin(); cit != parts.end(); ++cit) {
         std::stringstream name;
         name << fname << count++ << ".sigs";
-        std::ofstream out(name.str());
-        out << cit->first << std::endl;
-        for (auto comp: cit->second) {
-            for (auto sig: comp)
-                out << sig << " ";
-            out << std::endl;
-        }
-        // dump the whole queue (even bits that might not be in
-        // this partition).
-        if (q.size() > 0) {
-            out << "#q";
-            for (auto sig : q) {
-                out << " " << sig;
+        size_t nSigs = 0;
+        for (auto& comp: cit->second)
+            nSigs += (ctx.reps < 0) ? comp.size() :
+                std::min(comp.size(), (size_t) ctx.reps + 1);
+        // Each partition is formatted by its own task.
+        done.push_back(ctx.pool->enqueue(&write_partition, std::cref(unit),
+                    name.str(), std::cref(cit->first), std::cref(cit->second),
+                    q ? &pending[cit->first] : 0, maxN, std::cref(ctx)));
+
+        std::string file = name.str();
+        manifest << file.substr(file.rfind('/') + 1) << '\t'
+            << cit->second.size() << '\t' << nSigs << '\t' << cit->first
+            << '\n';
+    }
+    wait_all(done, ctx);
+}
+
+// Set value to the invariant inv of the triangulation sig, or to UNRESOLVED
+// if it takes too long.
+void compute_value(std::string& value, const Invariant inv,
+        const std::string sig, const Context* ctx) {
+    // Regina caches computed properties inside the triangulation, so each
+    // task needs its own.
+    NTriangulation *tri = NTriangulation::fromIsoSig(sig);
+    if (! Profile::lookup(inv, *tri, sig, ctx->cache, ctx->timeout, value)) {
+        value = UNRESOLVED;
+        ctx->timeouts->add(sig, inv.id);
+    }
+    delete tri;
+}
+
+// Set value to the approximation of the invariant inv, which must have one,
+// of the triangulation sig, and error to a bound on how far it is from the
+// true value.
+void compute_approx(double& value, double& error, const Invariant inv,
+        const std::string sig, const Context* ctx) {
+    // Approximations are cached alongside, but apart from, exact values, as
+    // the value followed by the error bound. An entry without a bound was
+    // written before we had one, so it proves nothing.
+    std::string id = inv.id + "~";
+    std::string cached;
+    if (ctx->cache && ctx->cache->find(sig, id, cached)) {
+        char* end;
+        value = strtod(cached.c_str(), &end);
+        if (*end == ' ')
+            error = strtod(end + 1, 0);
+        else
+            error = HUGE_VAL;
+        return;
+    }
+    NTriangulation *tri = NTriangulation::fromIsoSig(sig);
+    value = inv.approx(*tri, error);
+    delete tri;
+    if (ctx->cache) {
+        std::ostringstream s;
+        s << std::setprecision(17) << value << ' ' << error;
+        ctx->cache->store(sig, id, s.str());
+    }
+}
+
+// Which of the given approximate values could be the same invariant as some
+// other, given the bounds on their errors. Two values are only told apart if
+// the intervals value +- error around them do not meet.
+std::vector<bool> collisions(const std::vector<double>& values,
+        const std::vector<double>& errors) {
+    std::vector<bool> ans(values.size(), false);
+    std::vector<size_t> order;
+    for (size_t c = 0; c < values.size(); ++c)
+        if (std::isnan(values[c]) || std::isnan(errors[c]))
+            ans[c] = true; // Something has gone wrong, so play safe.
+        else
+            order.push_back(c);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return values[a] - errors[a] < values[b] - errors[b];
+    });
+    // Walk through the intervals by their lower ends, keeping the highest
+    // upper end so far and which interval it belongs to.
+    size_t reach = 0;
+    for (size_t k = 0; k < order.size(); ++k) {
+        size_t c = order[k];
+        if (k > 0 && values[c] - errors[c] <=
+                values[order[reach]] + errors[order[reach]])
+            ans[c] = ans[order[reach]] = true;
+        if (k == 0 || values[c] + errors[c] >
+                values[order[reach]] + errors[order[reach]])
+            reach = k;
+    }
+    return ans;
+}
+
+// Most levels of the chain that separate() computes ahead of the one it
+// needs.
+const int MAX_LOOKAHEAD = 2;
+
+// Invariants which separate() has started computing, by their position in
+// the chain and the root of the component. Whatever is still running is
+// waited for when this goes away, even if something has failed.
+struct Started {
+    // The exact value, or the approximation and its error bound if
+    // approximations are used for this invariant.
+    struct Value {
+        std::string exact;
+        double approx;
+        double error;
+        std::future<void> done;
+    };
+
+    ThreadPool* pool;
+    std::map<std::pair<size_t, Data*>, Value> values;
+
+    Started(ThreadPool* p) : pool(p) {}
+    ~Started() {
+        for (auto& v : values)
+            if (v.second.done.valid())
+                pool->wait(v.second.done);
+    }
+};
+
+// Start computing the invariant at the given position in the chain for the
+// component with root r, unless it has already been started. Invariants are
+// the same for every member of a component, so we compute them for the
+// member with the fewest tetrahedra, which is usually far cheaper
+// (particularly for Turaev-Viro invariants).
+void start_value(Started& started, size_t index, Data* r,
+        const Context& ctx) {
+    auto key = std::make_pair(index, r);
+    if (started.values.count(key))
+        return;
+    Invariant inv;
+    ctx.chain->at(index, inv);
+    Started::Value& v = started.values[key];
+    if (ctx.approx && inv.approx)
+        v.done = ctx.pool->enqueue(&compute_approx, std::ref(v.approx),
+                std::ref(v.error), inv, r->minimal->sig, &ctx);
+    else
+        v.done = ctx.pool->enqueue(&compute_value, std::ref(v.exact), inv,
+                r->minimal->sig, &ctx);
+}
+
+// Add up to depth more invariants from the chain to the profiles of the
+// components with the given roots, which must all have the same profile. A
+// component gets no more invariants once its profile differs from every
+// other component's, as that is enough to put it in a partition of its own.
+void separate(std::vector<Data*> active, int depth,
+        std::map<std::string, Profile>& profiles, const Context& ctx) {
+    if (active.empty())
+        return;
+    size_t start = profiles.at(active[0]->sig).values.size();
+    Invariant inv;
+    Started started(ctx.pool);
+    // One level at a time, so that nothing is spent on components which
+    // are already separated. Each component's value is computed by its own
+    // task.
+    for (int level = 0; level < depth && active.size() > 1 &&
+            ctx.chain->at(start + level, inv); ++level) {
+        for (auto r : active)
+            start_value(started, start + level, r, ctx);
+        // When there are fewer components than workers, the workers left
+        // over start on the next few levels for the same components, as
+        // most of them will usually still need them.
+        Invariant later;
+        for (int ahead = 1; ahead <= MAX_LOOKAHEAD &&
+                level + ahead < depth && ctx.pool->idle() > 0 &&
+                ctx.chain->at(start + level + ahead, later); ++ahead)
+            for (auto r : active)
+                start_value(started, start + level + ahead, r, ctx);
+
+        std::vector<Started::Value*> now;
+        for (auto r : active)
+            now.push_back(&started.values.at(std::make_pair(start + level,
+                            r)));
+        for (auto v : now)
+            ctx.pool->wait(v->done);
+        for (auto v : now)
+            v->done.get();
+        bool approx = ctx.approx && inv.approx;
+        std::vector<std::string> values(active.size());
+        std::vector<double> approxValues(active.size());
+        std::vector<double> approxErrors(active.size());
+        for (size_t c = 0; c < active.size(); ++c)
+            if (approx) {
+                approxValues[c] = now[c]->approx;
+                approxErrors[c] = now[c]->error;
+            } else
+                values[c] = now[c]->exact;
+
+        // Components with the same profile so far are compared with each
+        // other.
+        std::map<std::vector<std::string>, std::vector<size_t>> groups;
+        for (size_t c = 0; c < active.size(); ++c)
+            groups[profiles.at(active[c]->sig).values].push_back(c);
+
+        // Approximations only need to be made exact where they collide.
+        if (approx) {
+            std::vector<std::future<void>> done;
+            for (auto& g : groups) {
+                std::vector<double> group, errors;
+                for (auto c : g.second) {
+                    group.push_back(approxValues[c]);
+                    errors.push_back(approxErrors[c]);
+                }
+                std::vector<bool> close = collisions(group, errors);
+                for (size_t k = 0; k < g.second.size(); ++k) {
+                    size_t c = g.second[k];
+                    if (close[k])
+                        done.push_back(ctx.pool->enqueue(&compute_value,
+                                    std::ref(values[c]), inv,
+                                    active[c]->minimal->sig, &ctx));
+                    else {
+                        std::ostringstream s;
+                        s << '~' << std::setprecision(12) << approxValues[c];
+                        values[c] = s.str();
+                    }
+                }
+            }
+            wait_all(done, ctx);
+        }
+
+        // If this invariant is unresolved for some component, we cannot use
+        // it to tell that component apart from the rest of its group, so it
+        // is unresolved for all of them. Components that end up with a
+        // profile of their own are dropped.
+        std::map<std::vector<std::string>, int> seen;
+        for (auto& g : groups) {
+            bool unresolved = false;
+            for (auto c : g.second)
+                unresolved = unresolved || values[c] == UNRESOLVED;
+            for (auto c : g.second) {
+                Profile& p = profiles.at(active[c]->sig);
+                p.values.push_back(unresolved ? UNRESOLVED : values[c]);
+                ++seen[p.values];
             }
-            out << std::endl;
         }
-        // Now close file
-        out.close();
+        std::vector<Data*> next;
+        for (auto r : active)
+            if (seen[profiles.at(r->sig).values] > 1)
+                next.push_back(r);
+        active.swap(next);
     }
 }
 
-void partition(const std::string iname, int depth, const std::string oname) {
+void partition(const Input iname, int depth, const std::string oname,
+        const Context& ctx) {
     Cases waiting;
     std::map<Profile, Graph> graphs;
     std::map<Profile, unsigned> nComp;
-    read(iname, waiting, graphs, nComp);
+    int maxN = read(iname, waiting, graphs, nComp);
     std::map<std::string, Profile> profiles;
+    // Partitions are numbered across all input profiles, and listed in the
+    // manifest with their profile, number of components and signatures.
+    int count = 0;
+    std::ostringstream manifest;
+    manifest << "# file\tcomponents\tsigs\tprofile\n";
     for (auto graphit = graphs.begin(); graphit != graphs.end(); ++graphit) {
         Graph& g = graphit->second;
+        std::vector<Data*> roots;
         for (auto git = g.begin(); git != g.end(); ++git) {
             Data *r = git->second->root();
             auto pit = profiles.find(r->sig);
             if (pit == profiles.end()) {
-                Profile p(graphit->first);
-                if (nComp[graphit->first] > 1) {
-                    NTriangulation *tri = NTriangulation::fromIsoSig(r->sig);
-                    for(int i=0; i < depth; ++i) {
-                        p.extend(*tri);
-                    }
-                    delete tri;
-                }
-                profiles.insert(std::make_pair(r->sig, p));
+                profiles.insert(std::make_pair(r->sig,
+                            Profile(graphit->first)));
+                roots.push_back(r);
             }
         }
-        std::vector<std::string> q=waiting[graphit->first];
-        dump_partition(oname, g, profiles, q);
+        if (nComp[graphit->first] > 1)
+            separate(roots, depth, profiles, ctx);
+        auto wait = waiting.find(graphit->first);
+        dump_partition(iname.name, oname, g, profiles,
+                wait == waiting.end() ? 0 : &wait->second, maxN, count,
+                manifest, ctx);
     }
+    ctx.writer->write(oname + "manifest.txt", manifest.str(), iname.name);
+    ctx.writer->complete(iname.name);
     free_graphs(graphs);
     return;
 }
 
+// Input files smaller than this (in bytes) only hold a handful of components,
+// so rather than giving each its own task we group them into batches of
+// roughly BATCH_SIZE bytes. Each file in a batch is still processed (and
+// written) separately.
+const off_t SMALL_FILE = 64 * 1024;
+const off_t BATCH_SIZE = 1024 * 1024;
+
+// Name of the journal of completed input files, kept in the output directory.
+const char* JOURNAL = "sortcensus.journal";
+
+// Name of the list of invariants which took too long, in the output directory.
+const char* TIMEOUTS = "timeouts.txt";
+
+// Name of the log of Turaev-Viro computations, in the output directory.
+const char* TV_LOG = "turaevviro.log";
+
+// Most output a worker may have waiting to be written before it blocks.
+const size_t MAX_QUEUED_OUTPUT = 256 << 20;
+
+typedef void (*Worker)(const Input, int, const std::string, const Context&);
+typedef std::vector<std::pair<Input, std::string>> Batch;
+
+void run_batch(Worker work, const Batch files, int level, const Context& ctx) {
+    for (auto f: files)
+        work(f.first, level, f.second, ctx);
+}
+
+bool has_suffix(const std::string& s, const std::string& suffix) {
+    return s.length() > suffix.length() &&
+        s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+// The most CPUs' worth of time allowed by the cgroup quotas on the directory
+// dir below root and on each of its parents, or 0 if there is no quota. The
+// quota is "<quota> <period>" in cpu.max in cgroup v2, with a quota of "max"
+// if there is none, or in two files in cgroup v1, with a quota of -1.
+double cgroup_cpus(const std::string& root, std::string dir, bool v2) {
+    double ans = 0;
+    while (true) {
+        std::string quota;
+        double period = 0;
+        if (v2) {
+            std::ifstream f(root + dir + "/cpu.max");
+            if (! (f >> quota >> period))
+                period = 0;
+        } else {
+            std::ifstream q(root + dir + "/cpu.cfs_quota_us");
+            std::ifstream p(root + dir + "/cpu.cfs_period_us");
+            if (! (q >> quota && p >> period))
+                period = 0;
+        }
+        if (period > 0 && quota != "max" && atof(quota.c_str()) > 0) {
+            double cpus = atof(quota.c_str()) / period;
+            if (ans == 0 || cpus < ans)
+                ans = cpus;
+        }
+        if (dir.empty() || dir == "/")
+            return ans;
+        dir.erase(dir.rfind('/'));
+    }
+}
+
+// The number of threads to use if we are not told: the number of CPUs we can
+// run on, or fewer if a cgroup quota only gives us the time of fewer.
+unsigned default_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+        n = CPU_COUNT(&cpus);
+    // Our own cgroup is given in /proc/self/cgroup by lines of the form
+    // "<id>:<controllers>:<path>", where the line for cgroup v2 has no
+    // controllers, and in cgroup v1 the quota is set by the cpu controller.
+    // The paths are relative to where each hierarchy is mounted, which we
+    // take to be the usual place. Without the file, we fall back to the
+    // quota at the top of each hierarchy.
+    std::vector<double> quotas;
+    std::ifstream self("/proc/self/cgroup");
+    std::string line;
+    bool found = false;
+    while (std::getline(self, line)) {
+        size_t a = line.find(':');
+        size_t b = (a == std::string::npos) ? a : line.find(':', a + 1);
+        if (b == std::string::npos)
+            continue;
+        std::string controllers = line.substr(a + 1, b - a - 1);
+        std::string path = line.substr(b + 1);
+        found = true;
+        if (controllers.empty())
+            quotas.push_back(cgroup_cpus("/sys/fs/cgroup", path, true));
+        else if (("," + controllers + ",").find(",cpu,") != std::string::npos)
+            quotas.push_back(cgroup_cpus("/sys/fs/cgroup/cpu", path, false));
+    }
+    if (! found) {
+        quotas.push_back(cgroup_cpus("/sys/fs/cgroup", "", true));
+        quotas.push_back(cgroup_cpus("/sys/fs/cgroup/cpu", "", false));
+    }
+    for (auto q : quotas)
+        if (q > 0)
+            n = std::min(n, (unsigned) std::ceil(q));
+    return std::max(n, 1u);
+}
+
 void usage(char* name) {
-    std::cout << "Usage: " << name << " -p|-i <depth> <indir> <outdir>" << std::endl;
+    std::cout << "Usage: " << name << " [options] -p|-i <depth> <indir> <outdir>" << std::endl;
     std::cout << "  -p means build <depth> levels of the Pachner graph" << std::endl;
     std::cout << "  -i means add <depth> invariants to each profile" << std::endl;
-    std::cout << "  <indir> must be a directory containing .sigs files" << std::endl;
+    std::cout << "  <indir> must be a directory containing .sigs and/or .pack files" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  -j N      use N threads (default: $SORTCENSUS_THREADS, or the" << std::endl;
+    std::cout << "            number of CPUs available)" << std::endl;
+    std::cout << "  --resume  skip input files that a previous run with the same" << std::endl;
+    std::cout << "            arguments recorded as complete in <outdir>/" << JOURNAL << std::endl;
+    std::cout << "  --pack    write all output into one .pack file in <outdir>" << std::endl;
+    std::cout << "  --reps[=K]  only write the minimal triangulation of each component," << std::endl;
+    std::cout << "            its size, and up to K (default 0) other members" << std::endl;
+    std::cout << "  --stats   write a .stats.json summary next to each .sigs file" << std::endl;
+    std::cout << "  --cache FILE  look up and store invariants in FILE" << std::endl;
+    std::cout << "  --invariants LIST  comma-separated invariants to use with -i, in" << std::endl;
+    std::cout << "            order; --invariants=list shows what is available" << std::endl;
+    std::cout << "  --timeout SECS  give up on any one Turaev-Viro invariant after SECS seconds," << std::endl;
+    std::cout << "            listing it in <outdir>/" << TIMEOUTS << std::endl;
+    std::cout << "  --approx  compare approximate Turaev-Viro invariants first, and" << std::endl;
+    std::cout << "            only compute exact values where they are too close" << std::endl;
+    std::cout << "  --check-tv  check approximate Turaev-Viro invariants against regina" << std::endl;
     std::exit(-1);
 }
 
@@ -573,66 +1252,300 @@ extern errno;
 
 int main(int argc, char* argv[]) {
 
-    ThreadPool p(3); // TODO num threads
-    if (argc < 4)
-        usage(argv[0]);
-
     enum modes { PACHNER, PARTITION};
-    modes mode;
+    modes mode = PARTITION; // Until -i or -p says otherwise.
+    bool modeSet = false;
+    bool resume = false;
+    bool packed = false;
+    int reps = -1;
+    bool stats = false;
+    bool approx = false;
+    bool checkTV = false;
+    std::string cacheFile;
+    InvariantChain chain;
+    std::string invariants; // As given, if not the default.
+    double timeout = 0;
+    int threads = 0;
 
-    if (strncmp(argv[1], "-i", 2) == 0) {
-        mode = PARTITION;
-    } else if (strncmp(argv[1], "-p", 2) == 0) {
-        mode = PACHNER;
-    } else
+    enum { OPT_RESUME = 256, OPT_PACK, OPT_REPS, OPT_STATS,
+        OPT_CACHE, OPT_INVARIANTS, OPT_TIMEOUT, OPT_APPROX, OPT_CHECK_TV };
+    static struct option longopts[] = {
+        { "resume", no_argument, 0, OPT_RESUME },
+        { "pack", no_argument, 0, OPT_PACK },
+        { "reps", optional_argument, 0, OPT_REPS },
+        { "stats", no_argument, 0, OPT_STATS },
+        { "cache", required_argument, 0, OPT_CACHE },
+        { "invariants", required_argument, 0, OPT_INVARIANTS },
+        { "timeout", required_argument, 0, OPT_TIMEOUT },
+        { "approx", no_argument, 0, OPT_APPROX },
+        { "check-tv", no_argument, 0, OPT_CHECK_TV },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "ipj:", longopts, 0)) != -1) {
+        switch (opt) {
+            case 'i':
+                mode = PARTITION;
+                modeSet = true;
+                break;
+            case 'p':
+                mode = PACHNER;
+                modeSet = true;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads < 1)
+                    usage(argv[0]);
+                break;
+            case OPT_RESUME:
+                resume = true;
+                break;
+            case OPT_PACK:
+                packed = true;
+                break;
+            case OPT_REPS:
+                reps = optarg ? atoi(optarg) : 0;
+                break;
+            case OPT_STATS:
+                stats = true;
+                break;
+            case OPT_CACHE:
+                cacheFile = optarg;
+                break;
+            case OPT_INVARIANTS:
+                if (strcmp(optarg, "list") == 0) {
+                    list_invariants(std::cout);
+                    std::exit(0);
+                }
+                if (! chain.parse(optarg)) {
+                    std::cerr << "Error: Unknown invariant in " << optarg
+                        << "; try --invariants=list." << std::endl;
+                    std::exit(1);
+                }
+                invariants = optarg;
+                break;
+            case OPT_TIMEOUT:
+                timeout = atof(optarg);
+                break;
+            case OPT_APPROX:
+                approx = true;
+                break;
+            case OPT_CHECK_TV:
+                checkTV = true;
+                check_native_turaev_viro();
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (! modeSet || argc - optind < 3)
         usage(argv[0]);
 
-    int level = atoi(argv[2]);
-    DIR *d = opendir(argv[4]);
+    int level = atoi(argv[optind]);
+    std::string indir(argv[optind + 1]);
+    std::string outdir(argv[optind + 2]);
+
+    DIR *d = opendir(outdir.c_str());
     if (d == NULL) {
         if (errno == ENOENT) {
             // Set creation mask
             umask(0);
             // Create dir
-            mkdir(argv[4],0755);
+            mkdir(outdir.c_str(),0755);
         } else {
-        std::cerr << "Error: Could not open " << argv[3]
+        std::cerr << "Error: Could not open " << outdir
             << " as output directory." << std::endl;
         std::exit(1);
         }
+    } else
+        closedir(d);
+
+    // The first line of the journal records what the run was doing, so we
+    // never resume a run with different arguments. This includes every
+    // option which changes what goes in the output, or how it is written.
+    std::stringstream header;
+    header << "# " << (mode == PARTITION ? "-i " : "-p ") << level << " "
+        << indir;
+    if (packed)
+        header << " --pack";
+    if (reps >= 0)
+        header << " --reps=" << reps;
+    if (! invariants.empty())
+        header << " --invariants=" << invariants;
+    if (stats)
+        header << " --stats";
+    if (timeout > 0)
+        header << " --timeout=" << timeout;
+    if (approx)
+        header << " --approx";
+    if (checkTV)
+        header << " --check-tv";
+    std::string journal = outdir + "/" + JOURNAL;
+    std::set<std::string> done;
+    if (resume) {
+        if (! read_journal(journal, done)) {
+            std::cerr << "Error: Could not read " << journal
+                << " to resume from." << std::endl;
+            std::exit(1);
+        }
+        if (done.count(header.str()) == 0) {
+            std::cerr << "Error: " << journal << " was not written by a run"
+                << " with the same arguments." << std::endl;
+            std::exit(1);
+        }
     }
-    closedir(d);
 
-    d = opendir(argv[3]);
+    // Find every input file, looking inside any packs.
+    d = opendir(indir.c_str());
     if (d == NULL) {
-        std::cerr << "Error: Could not open " << argv[3]
+        std::cerr << "Error: Could not open " << indir
             << " as input directory." << std::endl;
         std::exit(1);
     }
     dirent *dirp;
-
+    struct Found {
+        Input in;
+        std::string name; // The file name, without any directory or pack.
+        off_t size;
+    };
+    std::vector<Found> inputs;
     while (( dirp = readdir(d)) != NULL) {
-        int len = strlen(dirp->d_name);
-        if (len > 5) {
-            if (strncmp( dirp->d_name + (len-5), ".sigs", 5) == 0) {
-                std::stringstream iname;
-                std::stringstream oname;
-                iname << argv[3] << "/" << dirp->d_name;
-                oname << argv[4] << "/";
-                if (mode == PARTITION) {
-                    std::string dname(dirp->d_name);
-                    oname << dname.substr(0, dname.length() - 5) << "_";
-                    p.enqueue(&partition, iname.str(), level, oname.str());
-                } else if (mode == PACHNER) {
-                    oname << dirp->d_name;
-                    p.enqueue(&pachner, iname.str(), level, oname.str());
-                }
+        std::string dname(dirp->d_name);
+        std::string path = indir + "/" + dname;
+        if (has_suffix(dname, ".sigs")) {
+            struct stat st;
+            // Files we cannot stat get a task of their own.
+            off_t size = (stat(path.c_str(), &st) == 0) ? st.st_size :
+                SMALL_FILE;
+            inputs.push_back(Found{ Input{ path, path, 0, -1 }, dname, size });
+        } else if (has_suffix(dname, ".pack")) {
+            std::vector<PackMember> members;
+            if (! read_pack_index(path, members)) {
+                std::cerr << "Error: Could not read " << path
+                    << " as a pack." << std::endl;
+                continue;
+            }
+            for (auto m: members) {
+                if (! has_suffix(m.name, ".sigs"))
+                    continue;
+                inputs.push_back(Found{ Input{ path + ":" + m.name, path,
+                        m.offset, m.length }, m.name, m.length });
             }
         }
     }
     closedir(d);
 
-    return 0;
+    // Output is named after the input file, so two inputs with the same name
+    // (in different packs, say) would overwrite each other's output.
+    std::set<std::string> names;
+    for (auto& input: inputs)
+        if (! names.insert(input.name).second) {
+            std::cerr << "Error: More than one input is called "
+                << input.name << "." << std::endl;
+            std::exit(1);
+        }
+
+    // A fresh run replaces the first pack, while a resumed run adds a new
+    // one alongside those from earlier attempts. The next pass reads every
+    // pack, so a fresh run must not leave later packs from an earlier run
+    // lying around.
+    std::string pack;
+    if (packed) {
+        int n = 0;
+        struct stat st;
+        do {
+            std::stringstream name;
+            name << outdir << "/sortcensus-" << n++ << ".pack";
+            pack = name.str();
+        } while (resume && stat(pack.c_str(), &st) == 0);
+        std::stringstream stale;
+        stale << outdir << "/sortcensus-1.pack";
+        if (! resume && stat(stale.str().c_str(), &st) == 0) {
+            std::cerr << "Error: " << stale.str() << " is left from an earlier"
+                << " run; remove the packs in " << outdir << " or use"
+                << " --resume." << std::endl;
+            std::exit(1);
+        }
+    }
+
+    std::unique_ptr<InvariantCache> cache;
+    if (! cacheFile.empty()) {
+        cache.reset(new InvariantCache(cacheFile));
+        if (! cache->ok()) {
+            std::cerr << "Error: Could not open " << cacheFile
+                << " as invariant cache." << std::endl;
+            std::exit(1);
+        }
+    }
+
+    // The writer and logs must outlive the pool, so that everything the
+    // workers queue up is written out before we exit.
+    Writer writer(MAX_QUEUED_OUTPUT, journal, resume, pack);
+    if (! resume)
+        writer.complete(header.str());
+    TimeoutLog timeouts(outdir + "/" + TIMEOUTS, resume);
+    if (! log_turaev_viro(outdir + "/" + TV_LOG, resume))
+        std::cerr << "Warning: Could not open " << outdir << "/" << TV_LOG
+            << "." << std::endl;
+    // The context is declared before the pool, so outlives every task.
+    Context ctx = { 0, &writer, reps, stats, cache.get(), &chain, approx,
+        timeout, &timeouts };
+    if (threads < 1 && getenv("SORTCENSUS_THREADS"))
+        threads = atoi(getenv("SORTCENSUS_THREADS"));
+    if (threads < 1)
+        threads = default_threads();
+    std::cerr << "Using " << threads << " thread(s)." << std::endl;
+    ThreadPool p(threads);
+    ctx.pool = &p;
+
+    Worker work = (mode == PARTITION) ? &partition : &pachner;
+    Batch batch;
+    off_t batchSize = 0;
+    std::vector<std::future<void>> files;
+
+    for (auto& input: inputs) {
+        const Input& in = input.in;
+        const std::string& dname = input.name;
+        if (done.count(in.name))
+            continue;
+        std::stringstream oname;
+        oname << outdir << "/";
+        if (mode == PARTITION) {
+            oname << dname.substr(0, dname.length() - 5) << "_";
+        } else if (mode == PACHNER) {
+            oname << dname;
+        }
+        if (input.size >= SMALL_FILE) {
+            files.push_back(p.enqueue(work, in, level, oname.str(),
+                        std::cref(ctx)));
+            continue;
+        }
+        batch.push_back(std::make_pair(in, oname.str()));
+        batchSize += input.size;
+        if (batchSize >= BATCH_SIZE) {
+            files.push_back(p.enqueue(&run_batch, work, batch, level,
+                        std::cref(ctx)));
+            batch.clear();
+            batchSize = 0;
+        }
+    }
+    if (! batch.empty())
+        files.push_back(p.enqueue(&run_batch, work, batch, level,
+                    std::cref(ctx)));
+
+    // Tasks enqueue subtasks of their own, which the pool refuses once it is
+    // stopping, so every input must be finished before the pool goes away.
+    // An input that fails is not journalled, so is done again on --resume.
+    int status = 0;
+    for (auto& f : files) {
+        try {
+            f.get();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            status = 1;
+        }
+    }
+    return status;
 }
 
 // vim: ts=4:sw=4
@@ -32,29 +32,98 @@
 // Derived from https://github.com/projgschj/ThreadPool by Jakob Progsch
 #include "threadpool.h"
 
-ThreadPool::ThreadPool(size_t threads) : stop(false) {
+// The pool whose worker is the calling thread, if any, and which worker it is.
+static thread_local const ThreadPool* current_pool = 0;
+static thread_local size_t current_worker;
+
+ThreadPool::ThreadPool(size_t threads) : pending(0), sleeping(0), stop(false) {
+  for (size_t i = 0; i <= threads; ++i)
+    queues.emplace_back(new Queue);
   for (size_t i = 0; i < threads; ++i) {
-    workers.emplace_back( [this] {
+    workers.emplace_back( [this, i] {
+        current_pool = this;
+        current_worker = i;
         for (;;) {
           std::function<void()> task;
-          {
-            std::unique_lock<std::mutex> lock(this->queue_mutex);
-            this->condition.wait(lock, [this] {
-                return this->stop || !this->tasks.empty(); });
-            if (this->stop && this->tasks.empty()) return;
-            task = std::move(this->tasks.front());
-            this->tasks.pop();
+          if (pop(task, false)) {
+            task();
+            continue;
           }
-          task();
+          // Nothing to do, so sleep until a task is pushed. A push checks
+          // sleeping after adding to pending, and we check pending after
+          // adding to sleeping, so one of us sees the other.
+          std::unique_lock<std::mutex> lock(this->sleep_mutex);
+          ++this->sleeping;
+          this->condition.wait(lock, [this] {
+              return this->stop || this->pending > 0; });
+          --this->sleeping;
+          if (this->stop && this->pending == 0) return;
         }
       }
     );
   }
 }
 
+void ThreadPool::push(std::function<void()> task) {
+  if (stop)
+    throw std::runtime_error("Called enqueue() on stopped ThreadPool");
+  Queue& q = (current_pool == this) ? *queues[current_worker] :
+    *queues.back();
+  // Count the task first, so pending never drops below zero.
+  ++pending;
+  {
+    std::unique_lock<std::mutex> lock(q.mutex);
+    q.tasks.push_back(std::move(task));
+  }
+  if (sleeping > 0) {
+    { std::unique_lock<std::mutex> lock(sleep_mutex); }
+    condition.notify_one();
+  }
+}
+
+bool ThreadPool::pop(std::function<void()>& task, bool subtasks) {
+  // Not workers.size(), which changes while the workers are starting.
+  size_t n = queues.size() - 1;
+  size_t self = (current_pool == this) ? current_worker : n;
+  // Our own queue, newest first.
+  if (self < n) {
+    Queue& q = *queues[self];
+    std::unique_lock<std::mutex> lock(q.mutex);
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+      --pending;
+      return true;
+    }
+  }
+  // Then the shared queue, then the other workers' queues, oldest first.
+  for (size_t k = subtasks ? 1 : 0; k <= n; ++k) {
+    size_t i = (k == 0) ? n : (self + k) % n;
+    if (k > 0 && i == self) continue;
+    Queue& q = *queues[i];
+    std::unique_lock<std::mutex> lock(q.mutex);
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+      --pending;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::run_one() {
+  // Other threads just wait, as all they could run is top-level tasks.
+  if (current_pool != this) return false;
+  std::function<void()> task;
+  if (!pop(task, true)) return false;
+  task();
+  return true;
+}
+
 ThreadPool::~ThreadPool() {
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::unique_lock<std::mutex> lock(sleep_mutex);
     stop = true;
   }
   condition.notify_all();
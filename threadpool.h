@@ -32,8 +32,10 @@
 #define _THREADPOOL_H
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -49,14 +51,51 @@ class ThreadPool {
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args)
       -> std::future<typename std::result_of<F(Args...)>::type>;
+    // Wait until res is ready. A worker runs queued subtasks (tasks enqueued
+    // by workers) in the meantime, so a task can wait on subtasks it has
+    // enqueued without tying up a worker (or deadlocking when every worker
+    // waits). It never starts a task enqueued from outside the pool, which
+    // could be a whole new job on top of the one that is waiting.
+    template<class T>
+    void wait(std::future<T>& res);
+    // Number of worker threads.
+    size_t size() const { return workers.size(); }
+    // Roughly how many workers have nothing to do, even once every queued
+    // task has been taken.
+    size_t idle() const {
+      long n = sleeping - pending;
+      return n > 0 ? n : 0;
+    }
     ~ThreadPool();
 
   private:
+    // Tasks are queued per worker, so that workers rarely contend for a
+    // lock. A task enqueued by a worker goes on that worker's own queue,
+    // and one enqueued by any other thread goes on a shared queue. A worker
+    // runs the newest task on its own queue (whose data is most likely still
+    // in cache), then the oldest shared task, then steals the oldest task on
+    // another worker's queue.
+    struct Queue {
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+    };
+
+    void push(std::function<void()> task);
+    // Take a task for the calling thread to run, if there is one. If
+    // subtasks is true, only take tasks enqueued by workers.
+    bool pop(std::function<void()>& task, bool subtasks);
+    // Run one queued subtask on the calling worker, if there is one.
+    bool run_one();
+
     std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queue_mutex;
+    // One queue per worker, then the shared queue.
+    std::vector<std::unique_ptr<Queue>> queues;
+    // Number of tasks queued, and of workers waiting for one.
+    std::atomic<long> pending;
+    std::atomic<long> sleeping;
+    std::mutex sleep_mutex;
     std::condition_variable condition;
-    bool stop;
+    std::atomic<bool> stop;
 };
 
 // inline implementations
@@ -71,16 +110,16 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
       );
 
   std::future<return_type> res = task->get_future();
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-
-    if (stop)
-      throw std::runtime_error("Called enqueue() on stopped ThreadPool");
+  push([task](){ (*task)(); });
+  return res;
+}
 
-    tasks.emplace([task](){ (*task)(); });
+template<class T>
+void ThreadPool::wait(std::future<T>& res) {
+  while (res.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    if (!run_one())
+      res.wait_for(std::chrono::milliseconds(1));
   }
-  condition.notify_one();
-  return res;
 }
 
 #endif // _THREADPOOL_H
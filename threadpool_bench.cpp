@@ -0,0 +1,197 @@
+/**************************************************************************
+ *                                                                        *
+ *  threadpool_bench.cpp                                                  *
+ *                                                                        *
+ *  Original ThreadPool class copyright (c) 2016 Jakob Progsch            *
+ *  For further details see https://github.com/projgschj/ThreadPool       *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+// Compares ThreadPool against the single-queue pool it replaced, on loads of
+// many small tasks. Build with "make bench" and run as
+// "threadpool_bench [threads]".
+#include <cstdlib>
+#include <queue>
+
+#include "threadpool.h"
+
+// The previous ThreadPool, with one queue behind one lock.
+class SingleQueuePool {
+  public:
+    SingleQueuePool(size_t size);
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+    // Wait until res is ready, running queued tasks on the calling thread in
+    // the meantime. This lets a task wait on subtasks it has enqueued
+    // without tying up a worker (or deadlocking when every worker waits).
+    template<class T>
+    void wait(std::future<T>& res);
+    // Number of worker threads.
+    size_t size() const { return workers.size(); }
+    ~SingleQueuePool();
+
+  private:
+    // Run one queued task on the calling thread, if there is one.
+    bool run_one();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    bool stop;
+};
+
+template<class F, class... Args>
+auto SingleQueuePool::enqueue(F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
+  using return_type = typename std::result_of<F(Args...)>::type;
+
+  auto task = std::make_shared<std::packaged_task<return_type()>> (
+      std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+      );
+
+  std::future<return_type> res = task->get_future();
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+
+    if (stop)
+      throw std::runtime_error("Called enqueue() on stopped SingleQueuePool");
+
+    tasks.emplace([task](){ (*task)(); });
+  }
+  condition.notify_one();
+  return res;
+}
+
+template<class T>
+void SingleQueuePool::wait(std::future<T>& res) {
+  while (res.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    if (!run_one())
+      res.wait_for(std::chrono::milliseconds(1));
+  }
+}
+
+SingleQueuePool::SingleQueuePool(size_t threads) : stop(false) {
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back( [this] {
+        for (;;) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(this->queue_mutex);
+            this->condition.wait(lock, [this] {
+                return this->stop || !this->tasks.empty(); });
+            if (this->stop && this->tasks.empty()) return;
+            task = std::move(this->tasks.front());
+            this->tasks.pop();
+          }
+          task();
+        }
+      }
+    );
+  }
+}
+
+bool SingleQueuePool::run_one() {
+  std::function<void()> task;
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (tasks.empty()) return false;
+    task = std::move(tasks.front());
+    tasks.pop();
+  }
+  task();
+  return true;
+}
+
+SingleQueuePool::~SingleQueuePool() {
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    stop = true;
+  }
+  condition.notify_all();
+  for(std::thread &worker: workers)
+    worker.join();
+}
+
+// A little work, so tasks are small but not empty.
+static void spin(std::atomic<long>* sum, int n) {
+  long x = 0;
+  for (int i = 0; i < n; ++i) x += i * i;
+  *sum += x;
+}
+
+// Many small tasks, all enqueued by the main thread.
+template<class Pool>
+static void flat(Pool& pool, std::atomic<long>* sum) {
+  std::vector<std::future<void>> done;
+  for (int i = 0; i < 200000; ++i)
+    done.push_back(pool.enqueue(&spin, sum, 100));
+  for (auto& d : done) pool.wait(d);
+}
+
+// A task enqueues many small subtasks and waits on them.
+template<class Pool>
+static void parent(Pool* pool, std::atomic<long>* sum) {
+  std::vector<std::future<void>> done;
+  for (int i = 0; i < 1000; ++i)
+    done.push_back(pool->enqueue(&spin, sum, 100));
+  for (auto& d : done) pool->wait(d);
+}
+
+// Tasks which fan out into subtasks, as separate() does.
+template<class Pool>
+static void nested(Pool& pool, std::atomic<long>* sum) {
+  std::vector<std::future<void>> done;
+  for (int i = 0; i < 200; ++i)
+    done.push_back(pool.enqueue(&parent<Pool>, &pool, sum));
+  for (auto& d : done) pool.wait(d);
+}
+
+template<class Pool>
+static void time(const char* pool, const char* load,
+    void (*run)(Pool&, std::atomic<long>*), size_t threads) {
+  std::atomic<long> sum(0);
+  Pool p(threads);
+  auto start = std::chrono::steady_clock::now();
+  run(p, &sum);
+  std::chrono::duration<double> taken =
+    std::chrono::steady_clock::now() - start;
+  std::cout << pool << "\t" << load << "\t" << taken.count() << "s"
+    << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  size_t threads = (argc > 1) ? atoi(argv[1]) :
+    std::thread::hardware_concurrency();
+  std::cout << threads << " thread(s)" << std::endl;
+  time<SingleQueuePool>("single-queue", "flat", &flat<SingleQueuePool>,
+      threads);
+  time<ThreadPool>("work-stealing", "flat", &flat<ThreadPool>, threads);
+  time<SingleQueuePool>("single-queue", "nested", &nested<SingleQueuePool>,
+      threads);
+  time<ThreadPool>("work-stealing", "nested", &nested<ThreadPool>, threads);
+  return 0;
+}
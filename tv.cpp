@@ -0,0 +1,384 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "tv.h"
+
+using namespace regina;
+
+namespace {
+
+// Most entries in any table of weights, either the 6j-symbols or a table
+// built while summing out edges.
+const double MAX_TABLE = 1 << 23;
+
+// The weights in the Turaev-Viro state sum for one r and root, following
+// Regina, where each edge is coloured with one of 0, ..., r-2. Tables over
+// several edges are indexed by c0 + n c1 + n^2 c2 + ..., where c0, c1, ... are
+// the colours of the edges and n = r - 1 is the number of colours.
+//
+// Each table has a second table of the same shape holding the sum of the
+// absolute values of the terms that went into each weight. The rounding
+// error in a weight is at most error times this, which is what lets
+// turaev_viro_native() bound the error in the whole state sum.
+struct Weights {
+    size_t n;
+    double error;
+    double vertex;
+    std::vector<double> edge, edgeAbs;
+    // By the colours of the three edges of a triangle.
+    std::vector<double> triangle, triangleAbs;
+    // By the colours of edges 0, ..., 5 of a tetrahedron, numbered as in
+    // Regina; these are the quantum 6j-symbols.
+    std::vector<double> tetrahedron, tetrahedronAbs;
+
+    Weights(unsigned long r, unsigned long whichRoot);
+};
+
+Weights::Weights(unsigned long r, unsigned long whichRoot) : n(r - 1) {
+    double angle = M_PI * whichRoot / r;
+    // Each weight is a sum of terms each made of at most eight quantum
+    // factorials. A factorial is a product of fewer than r ratios of sines,
+    // and each sine is good to about r^2 units in the last place, since
+    // sin(k angle) is never smaller than sin(pi / r) and its argument is out
+    // by up to r units.
+    error = 8 * (std::pow(double(r), 3) + 4 * r) *
+        std::numeric_limits<double>::epsilon();
+    // The quantum factorials [0]!, [1]!, ..., which are zero from [r]! on.
+    std::vector<double> fact(2 * r, 0);
+    fact[0] = 1;
+    for (size_t k = 1; k < r; ++k)
+        fact[k] = fact[k - 1] * std::sin(k * angle) / std::sin(angle);
+    auto admissible = [r](size_t i, size_t j, size_t k) {
+        return (i + j + k) % 2 == 0 && i <= j + k && j <= k + i &&
+            k <= i + j && i + j + k <= 2 * (r - 2);
+    };
+
+    vertex = 2 * std::sin(angle) * std::sin(angle) / r;
+
+    edge.resize(n);
+    edgeAbs.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        edge[i] = ((i % 2) ? -1 : 1) * fact[i + 1] / fact[i];
+        edgeAbs[i] = std::fabs(edge[i]);
+    }
+
+    triangle.assign(n * n * n, 0);
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+            for (size_t k = 0; k < n; ++k)
+                if (admissible(i, j, k))
+                    triangle[i + n * (j + n * k)] =
+                        (((i + j + k) / 2 % 2) ? -1 : 1) *
+                        fact[(i + j - k) / 2] * fact[(j + k - i) / 2] *
+                        fact[(k + i - j) / 2] / fact[(i + j + k) / 2 + 1];
+    triangleAbs.resize(triangle.size());
+    for (size_t t = 0; t < triangle.size(); ++t)
+        triangleAbs[t] = std::fabs(triangle[t]);
+
+    size_t size = n * n * n * n * n * n;
+    tetrahedron.assign(size, 0);
+    tetrahedronAbs.assign(size, 0);
+    for (size_t t = 0; t < size; ++t) {
+        size_t c[6];
+        for (size_t e = 0, rest = t; e < 6; ++e, rest /= n)
+            c[e] = rest % n;
+        // Edges 0, 1, 3 bound triangle 012, so opposite edges are 0 and 5,
+        // 1 and 4, and 2 and 3.
+        size_t face[4][3] = { { c[3], c[4], c[5] }, { c[1], c[2], c[5] },
+            { c[0], c[2], c[4] }, { c[0], c[1], c[3] } };
+        size_t quad[3] = { (c[0] + c[5] + c[1] + c[4]) / 2,
+            (c[0] + c[5] + c[2] + c[3]) / 2,
+            (c[1] + c[4] + c[2] + c[3]) / 2 };
+        size_t sums[4];
+        bool ok = true;
+        for (int f = 0; f < 4; ++f) {
+            ok = ok && admissible(face[f][0], face[f][1], face[f][2]);
+            sums[f] = (face[f][0] + face[f][1] + face[f][2]) / 2;
+        }
+        if (! ok)
+            continue;
+        size_t low = *std::max_element(sums, sums + 4);
+        size_t high = *std::min_element(quad, quad + 3);
+        double sum = 0, sumAbs = 0;
+        for (size_t z = low; z <= high; ++z) {
+            double term = ((z % 2) ? -1 : 1) * fact[z + 1];
+            for (int f = 0; f < 4; ++f)
+                term /= fact[z - sums[f]];
+            for (int q = 0; q < 3; ++q)
+                term /= fact[quad[q] - z];
+            sum += term;
+            sumAbs += std::fabs(term);
+        }
+        tetrahedron[t] = sum;
+        tetrahedronAbs[t] = sumAbs;
+    }
+}
+
+// The weights for r and whichRoot, which are computed the first time they are
+// asked for.
+std::shared_ptr<const Weights> weights(unsigned long r,
+        unsigned long whichRoot) {
+    static std::mutex mutex;
+    static std::map<std::pair<unsigned long, unsigned long>,
+        std::shared_ptr<const Weights>> all;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& ans = all[std::make_pair(r, whichRoot)];
+    if (! ans)
+        ans.reset(new Weights(r, whichRoot));
+    return ans;
+}
+
+// A table of numbers indexed by the colours of some edges, its scope, which
+// is kept in increasing order. The entry for a colouring c is
+// data[c[scope[0]] * stride[0] + c[scope[1]] * stride[1] + ...], and data
+// either belongs to a Weights or is held by own. The same entry of abs is
+// the same sum taken over the absolute values of the weights, and is held
+// by ownAbs when data is held by own.
+struct Factor {
+    std::vector<size_t> scope;
+    std::vector<size_t> stride;
+    const double* data;
+    const double* abs;
+    std::shared_ptr<std::vector<double>> own, ownAbs;
+};
+
+// The factor for a table of weights, indexed as in Weights, over the given
+// edges. An edge can appear more than once.
+Factor weight_factor(const std::vector<size_t>& edges, const double* data,
+        const double* abs, size_t n) {
+    std::map<size_t, size_t> strides;
+    size_t stride = 1;
+    for (auto e : edges) {
+        strides[e] += stride;
+        stride *= n;
+    }
+    Factor ans;
+    for (auto& s : strides) {
+        ans.scope.push_back(s.first);
+        ans.stride.push_back(s.second);
+    }
+    ans.data = data;
+    ans.abs = abs;
+    return ans;
+}
+
+// The order in which to sum out edges. Each time we take the edge whose
+// neighbours (the edges it shares a factor with) need the fewest new edges
+// between them to make them all neighbours of each other, as they will be
+// once it is summed out. Sets width to the most neighbours any edge has when
+// it is summed out, which is the width of the corresponding tree
+// decomposition.
+std::vector<size_t> elimination_order(size_t nEdges,
+        const std::vector<Factor>& factors, size_t& width) {
+    std::vector<std::set<size_t>> adj(nEdges);
+    for (auto& f : factors)
+        for (auto u : f.scope)
+            for (auto v : f.scope)
+                if (u != v)
+                    adj[u].insert(v);
+    std::vector<bool> done(nEdges, false);
+    std::vector<size_t> order;
+    width = 0;
+    while (order.size() < nEdges) {
+        size_t best = nEdges, bestFill = 0;
+        for (size_t v = 0; v < nEdges; ++v) {
+            if (done[v])
+                continue;
+            size_t fill = 0;
+            for (auto a : adj[v])
+                for (auto b : adj[v])
+                    if (a < b && ! adj[a].count(b))
+                        ++fill;
+            if (best == nEdges || fill < bestFill ||
+                    (fill == bestFill && adj[v].size() < adj[best].size())) {
+                best = v;
+                bestFill = fill;
+            }
+        }
+        width = std::max(width, adj[best].size());
+        for (auto a : adj[best]) {
+            adj[a].erase(best);
+            for (auto b : adj[best])
+                if (a != b)
+                    adj[a].insert(b);
+        }
+        adj[best].clear();
+        done[best] = true;
+        order.push_back(best);
+    }
+    return order;
+}
+
+// Multiply the given factors, each of which includes edge v, and sum out v.
+Factor sum_out(size_t v, const std::vector<Factor>& with, size_t n) {
+    std::set<size_t> all;
+    for (auto& f : with)
+        all.insert(f.scope.begin(), f.scope.end());
+    all.erase(v);
+
+    Factor ans;
+    ans.scope.assign(all.begin(), all.end());
+    size_t size = 1;
+    for (size_t d = 0; d < ans.scope.size(); ++d) {
+        ans.stride.push_back(size);
+        size *= n;
+    }
+    ans.own = std::make_shared<std::vector<double>>(size);
+    ans.data = ans.own->data();
+    ans.ownAbs = std::make_shared<std::vector<double>>(size);
+    ans.abs = ans.ownAbs->data();
+
+    // How far each factor's index moves for each colour of v, and of each
+    // edge in the answer's scope.
+    std::vector<size_t> across(with.size());
+    std::vector<std::vector<size_t>> step(ans.scope.size(),
+            std::vector<size_t>(with.size(), 0));
+    for (size_t f = 0; f < with.size(); ++f)
+        for (size_t s = 0; s < with[f].scope.size(); ++s) {
+            size_t e = with[f].scope[s];
+            if (e == v)
+                across[f] = with[f].stride[s];
+            else
+                step[std::lower_bound(ans.scope.begin(), ans.scope.end(), e) -
+                    ans.scope.begin()][f] = with[f].stride[s];
+        }
+
+    // Fill in the answer in order, so its entries are written one after
+    // another.
+    std::vector<size_t> colour(ans.scope.size(), 0);
+    std::vector<size_t> index(with.size(), 0);
+    // A weight can round to zero when the colouring is admissible, so it is
+    // abs which says whether a term is left out.
+    for (size_t out = 0; out < size; ++out) {
+        double sum = 0, sumAbs = 0;
+        for (size_t c = 0; c < n; ++c) {
+            double term = 1, termAbs = 1;
+            for (size_t f = 0; f < with.size() && termAbs != 0; ++f) {
+                term *= with[f].data[index[f] + c * across[f]];
+                termAbs *= with[f].abs[index[f] + c * across[f]];
+            }
+            sum += term;
+            sumAbs += termAbs;
+        }
+        (*ans.own)[out] = sum;
+        (*ans.ownAbs)[out] = sumAbs;
+        for (size_t d = 0; d < colour.size(); ++d) {
+            for (size_t f = 0; f < with.size(); ++f)
+                index[f] += step[d][f];
+            if (++colour[d] < n)
+                break;
+            for (size_t f = 0; f < with.size(); ++f)
+                index[f] -= n * step[d][f];
+            colour[d] = 0;
+        }
+    }
+    return ans;
+}
+
+} // namespace
+
+bool turaev_viro_native(const NTriangulation& tri, unsigned long r,
+        unsigned long whichRoot, double& value, int* width, double* error) {
+    if (r < 3 || ! tri.isClosed() || std::pow(r - 1.0, 6) > MAX_TABLE)
+        return false;
+    std::shared_ptr<const Weights> w = weights(r, whichRoot);
+    size_t n = w->n;
+
+    std::vector<Factor> factors;
+    for (size_t e = 0; e < tri.countEdges(); ++e)
+        factors.push_back(weight_factor(std::vector<size_t>(1, e),
+                    w->edge.data(), w->edgeAbs.data(), n));
+    for (size_t f = 0; f < tri.countTriangles(); ++f) {
+        std::vector<size_t> edges;
+        for (int k = 0; k < 3; ++k)
+            edges.push_back(tri.triangle(f)->edge(k)->index());
+        factors.push_back(weight_factor(edges, w->triangle.data(),
+                    w->triangleAbs.data(), n));
+    }
+    for (size_t t = 0; t < tri.size(); ++t) {
+        std::vector<size_t> edges;
+        for (int k = 0; k < 6; ++k)
+            edges.push_back(tri.tetrahedron(t)->edge(k)->index());
+        factors.push_back(weight_factor(edges, w->tetrahedron.data(),
+                    w->tetrahedronAbs.data(), n));
+    }
+
+    size_t most;
+    std::vector<size_t> order = elimination_order(tri.countEdges(), factors,
+            most);
+    if (std::pow(double(n), double(most)) > MAX_TABLE)
+        return false;
+    for (auto v : order) {
+        std::vector<Factor> with, without;
+        for (auto& f : factors)
+            if (std::binary_search(f.scope.begin(), f.scope.end(), v))
+                with.push_back(f);
+            else
+                without.push_back(f);
+        without.push_back(sum_out(v, with, n));
+        factors.swap(without);
+    }
+
+    // Everything left has an empty scope.
+    double ans = std::pow(w->vertex, double(tri.countVertices()));
+    double ansAbs = ans;
+    for (auto& f : factors) {
+        ans *= f.data[0];
+        ansAbs *= f.abs[0];
+    }
+    value = ans;
+    if (width)
+        *width = most;
+    if (error) {
+        // Each term of the state sum is a product of one weight from each
+        // table and the vertex weights, so it is out by at most
+        // (weights + vertices) (w->error + epsilon) of its absolute value,
+        // and summing n terms at each of the edges adds at most n epsilon
+        // of the absolute values summed. The factor of two covers the
+        // higher order terms, which are tiny next to these.
+        double weights = tri.countEdges() + tri.countTriangles() + tri.size();
+        double eps = std::numeric_limits<double>::epsilon();
+        *error = 2 * ansAbs * ((weights + tri.countVertices()) *
+            (w->error + eps) + tri.countEdges() * n * eps);
+    }
+    return true;
+}
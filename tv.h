@@ -0,0 +1,62 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+
+#ifndef _TV_H
+#define _TV_H
+
+#include <triangulation/ntriangulation.h>
+
+/**
+ * A floating point evaluation of the Turaev-Viro invariant, giving the same
+ * value as regina::NTriangulation::turaevViroApprox(r, whichRoot) but
+ * written for evaluating the same r on very many triangulations.
+ *
+ * The quantum 6j-symbols and other weights of the state sum for each r and
+ * root are computed once, the first time they are needed, and then shared
+ * (read only) by every thread. The state sum itself is evaluated by summing
+ * out the colour of one edge at a time, in an order chosen so that the
+ * tables built along the way stay small; this is dynamic programming over a
+ * tree decomposition of the triangulation.
+ *
+ * Returns false, leaving value alone, if tri is not closed or r is too large
+ * for the tables (or the triangulation's width too large for the state sum)
+ * to fit in memory, in which case regina should be used instead. If width is
+ * not null it is set to the width of the decomposition used. If error is
+ * not null it is set to a bound on the rounding error in value, found by
+ * carrying the same sum over the absolute values of the weights alongside
+ * the real one.
+ */
+bool turaev_viro_native(const regina::NTriangulation& tri, unsigned long r,
+        unsigned long whichRoot, double& value, int* width = 0,
+        double* error = 0);
+
+#endif // _TV_H
@@ -0,0 +1,109 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+
+// Checks the native Turaev-Viro evaluator (tv.h) against regina's
+// turaevViroApprox() on a range of closed manifolds, including some that are
+// not minimal triangulations, for every r and root we use. Prints each
+// difference, and exits with a non-zero status if there are any. Build and
+// run with "make check-tv".
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <triangulation/nexampletriangulation.h>
+#include <triangulation/ntriangulation.h>
+
+#include "tv.h"
+
+using namespace regina;
+
+// Largest r to check.
+const unsigned long MAX_R = 7;
+
+// Largest relative difference allowed, as in --check-tv.
+const double TOLERANCE = 1e-9;
+
+int main() {
+    std::vector<std::pair<std::string, NTriangulation*>> tris = {
+        { "S3", NExampleTriangulation::threeSphere() },
+        { "S2xS1", NExampleTriangulation::s2xs1() },
+        { "RP2xS1", NExampleTriangulation::rp2xs1() },
+        { "RP3#RP3", NExampleTriangulation::rp3rp3() },
+        { "L(3,1)", NExampleTriangulation::lens(3, 1) },
+        { "L(5,2)", NExampleTriangulation::lens(5, 2) },
+        { "L(7,2)", NExampleTriangulation::lens(7, 2) },
+        { "Poincare", NExampleTriangulation::poincareHomologySphere() },
+        { "orientable hyperbolic",
+            NExampleTriangulation::smallClosedOrblHyperbolic() },
+        { "non-orientable hyperbolic",
+            NExampleTriangulation::smallClosedNonOrblHyperbolic() },
+    };
+    // A 2-3 move gives a second, non-minimal, triangulation of each.
+    size_t n = tris.size();
+    for (size_t i = 0; i < n; ++i) {
+        NTriangulation* t = new NTriangulation(*tris[i].second);
+        for (size_t f = 0; f < t->countTriangles(); ++f)
+            if (t->twoThreeMove(t->triangle(f), true, true))
+                break;
+        tris.push_back(std::make_pair(tris[i].first + " after 2-3", t));
+    }
+
+    int checked = 0, differ = 0;
+    for (auto& t : tris) {
+        for (unsigned long r = 3; r <= MAX_R; ++r)
+            // The roots used for tv(r,true) and tv(r,false).
+            for (unsigned long root = 1; root <= 2; ++root) {
+                if (root == 2 && r % 2 == 0)
+                    continue;
+                double native;
+                double regina = t.second->turaevViroApprox(r, root);
+                ++checked;
+                if (! turaev_viro_native(*t.second, r, root, native)) {
+                    std::cout << t.first << " r=" << r << " root=" << root
+                        << ": not evaluated natively" << std::endl;
+                    ++differ;
+                } else if (std::fabs(native - regina) >
+                        TOLERANCE * std::max(1.0, std::fabs(regina))) {
+                    std::cout << t.first << " r=" << r << " root=" << root
+                        << ": native " << native << ", regina " << regina
+                        << std::endl;
+                    ++differ;
+                }
+            }
+        delete t.second;
+    }
+    std::cout << checked << " values checked, " << differ << " differ."
+        << std::endl;
+    return differ ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "writer.h"
+
+const char* PACK_MAGIC = "SORTCENSUS-PACK 1\n";
+// The trailer is the index offset as a 20 digit number, then this.
+const char* PACK_TRAILER = " SORTCENSUS-INDEX\n";
+const size_t PACK_TRAILER_LEN = 20 + strlen(PACK_TRAILER);
+
+// Write all of data to fd, returning false on error.
+static bool write_all(int fd, const std::string& data) {
+    const char* pos = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, pos, left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        pos += n;
+        left -= n;
+    }
+    return true;
+}
+
+// Whether the file fname exists and holds exactly data.
+static bool has_contents(const std::string& fname, const std::string& data) {
+    struct stat st;
+    if (stat(fname.c_str(), &st) != 0 || st.st_size != (off_t) data.size())
+        return false;
+    std::ifstream in(fname, std::ios::binary);
+    std::vector<char> buf(1 << 16);
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t n = std::min(buf.size(), data.size() - pos);
+        if (! in.read(buf.data(), n) ||
+                data.compare(pos, n, buf.data(), n) != 0)
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+// Whether the files a and b both exist and have the same contents.
+static bool same_contents(const std::string& a, const std::string& b) {
+    struct stat sa, sb;
+    if (stat(a.c_str(), &sa) != 0 || stat(b.c_str(), &sb) != 0 ||
+            sa.st_size != sb.st_size)
+        return false;
+    std::ifstream ia(a, std::ios::binary);
+    std::ifstream ib(b, std::ios::binary);
+    std::vector<char> ba(1 << 16), bb(1 << 16);
+    off_t left = sa.st_size;
+    while (left > 0) {
+        size_t n = std::min((off_t) ba.size(), left);
+        if (! ia.read(ba.data(), n) || ! ib.read(bb.data(), n) ||
+                memcmp(ba.data(), bb.data(), n) != 0)
+            return false;
+        left -= n;
+    }
+    return true;
+}
+
+// The directory containing fname.
+static std::string dir_of(const std::string& fname) {
+    size_t slash = fname.rfind('/');
+    return (slash == std::string::npos) ? "." : fname.substr(0, slash);
+}
+
+// Sync dir, so that a rename into it is durable.
+static void sync_dir(const std::string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+Writer::Writer(size_t maxQueued_, const std::string& journal, bool append,
+        const std::string& pack_) :
+        journalFd(-1), pack(pack_), packFd(-1), packSize(0), nChanged(0),
+        unchanged(0), queued(0), maxQueued(maxQueued_), stop(false) {
+    if (! journal.empty()) {
+        journalFd = open(journal.c_str(),
+                O_WRONLY | O_CREAT | O_APPEND | (append ? 0 : O_TRUNC), 0644);
+        if (journalFd < 0)
+            std::cerr << "Error: Could not open journal " << journal << ": "
+                << strerror(errno) << std::endl;
+    }
+    if (! pack.empty()) {
+        std::string tmp = pack + ".tmp";
+        packFd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (packFd < 0 || ! write_all(packFd, PACK_MAGIC)) {
+            std::cerr << "Error: Could not write " << tmp << ": "
+                << strerror(errno) << std::endl;
+        } else
+            packSize = strlen(PACK_MAGIC);
+    }
+    thread = std::thread(&Writer::run, this);
+}
+
+Writer::~Writer() {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        stop = true;
+    }
+    notEmpty.notify_all();
+    thread.join();
+    if (! pack.empty())
+        finishPack();
+    if (journalFd >= 0)
+        close(journalFd);
+    std::cerr << nChanged << " output file(s) changed, " << unchanged
+        << " unchanged." << std::endl;
+}
+
+void Writer::write(const std::string& fname, std::string data,
+        const std::string& unit) {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        // Always accept a job when nothing is queued, even if it is larger
+        // than maxQueued on its own.
+        notFull.wait(lock, [this, &data] {
+                return queued == 0 || queued + data.size() <= maxQueued; });
+        queued += data.size();
+        jobs.push(Job{fname, std::move(data), unit, false});
+    }
+    notEmpty.notify_one();
+}
+
+void Writer::complete(const std::string& unit) {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        jobs.push(Job{unit, std::string(), unit, true});
+    }
+    notEmpty.notify_one();
+}
+
+void Writer::run() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            notEmpty.wait(lock, [this] { return stop || !jobs.empty(); });
+            if (stop && jobs.empty())
+                return;
+            job = std::move(jobs.front());
+            jobs.pop();
+        }
+        if (job.journal) {
+            writeJournal(job.fname);
+            continue;
+        }
+        if (! writeFile(job.fname, job.data))
+            failed.insert(job.unit);
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queued -= job.data.size();
+        }
+        notFull.notify_all();
+    }
+}
+
+bool Writer::writeFile(const std::string& fname, const std::string& data) {
+    if (! pack.empty()) {
+        if (packFd < 0)
+            return false;
+        std::string name = fname.substr(fname.rfind('/') + 1);
+        if (! packMembers.insert(name).second) {
+            std::cerr << "Error: Could not write " << fname << " to " << pack
+                << ", which already has a member " << name << "." << std::endl;
+            return false;
+        }
+        if (! write_all(packFd, data)) {
+            std::cerr << "Error: Could not write " << fname << " to "
+                << pack << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        std::ostringstream entry;
+        entry << packSize << ' ' << data.size() << ' ' << name << '\n';
+        packIndex += entry.str();
+        packSize += data.size();
+        return true;
+    }
+    // Leave the file (and its mtime) alone if nothing has changed.
+    if (has_contents(fname, data)) {
+        ++unchanged;
+        return true;
+    }
+    std::string tmp = fname + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error: Could not write " << tmp << ": "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+    bool ok = write_all(fd, data) && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (! ok || rename(tmp.c_str(), fname.c_str()) != 0) {
+        std::cerr << "Error: Could not write " << fname << ": "
+            << strerror(errno) << std::endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+    dirty.insert(dir_of(fname));
+    changed(fname);
+    return true;
+}
+
+void Writer::changed(const std::string& fname) {
+    ++nChanged;
+    std::cout << fname << std::endl;
+}
+
+void Writer::writeJournal(const std::string& unit) {
+    if (journalFd < 0)
+        return;
+    if (failed.count(unit)) {
+        std::cerr << "Error: Not recording " << unit << " as done, as some"
+            << " of its output could not be written." << std::endl;
+        return;
+    }
+    // Once anything has gone into the pack, nothing more is on disk until
+    // the pack is finished. Anything journalled before that (such as a
+    // header) can go straight in.
+    if (! pack.empty() && ! packIndex.empty()) {
+        deferred.push_back(unit);
+        return;
+    }
+    // Make sure the renames themselves are on disk before we claim the
+    // unit is finished.
+    for (auto dir: dirty)
+        sync_dir(dir);
+    dirty.clear();
+    if (! write_all(journalFd, unit + "\n") || fsync(journalFd) != 0)
+        std::cerr << "Error: Could not update journal: "
+            << strerror(errno) << std::endl;
+}
+
+void Writer::finishPack() {
+    if (packFd < 0)
+        return;
+    char trailer[21];
+    snprintf(trailer, sizeof(trailer), "%020" PRIdMAX, (intmax_t) packSize);
+    std::string tmp = pack + ".tmp";
+    bool ok = write_all(packFd, packIndex + trailer + PACK_TRAILER) &&
+        fsync(packFd) == 0;
+    ok = (close(packFd) == 0) && ok;
+    packFd = -1;
+    if (ok && same_contents(tmp, pack)) {
+        unlink(tmp.c_str());
+        ++unchanged;
+    } else if (! ok || rename(tmp.c_str(), pack.c_str()) != 0) {
+        // None of the deferred units' output is on disk, so none of them
+        // may go in the journal.
+        std::cerr << "Error: Could not write " << pack << ": "
+            << strerror(errno) << "; not recording " << deferred.size()
+            << " input(s) as done." << std::endl;
+        unlink(tmp.c_str());
+        return;
+    } else {
+        sync_dir(dir_of(pack));
+        changed(pack);
+    }
+    if (journalFd < 0)
+        return;
+    std::string units;
+    for (auto unit: deferred)
+        units += unit + "\n";
+    if (! write_all(journalFd, units) || fsync(journalFd) != 0)
+        std::cerr << "Error: Could not update journal: "
+            << strerror(errno) << std::endl;
+}
+
+bool read_pack_index(const std::string& pack,
+        std::vector<PackMember>& members) {
+    std::ifstream in(pack, std::ios::binary);
+    std::string magic(strlen(PACK_MAGIC), '\0');
+    if (! in.read(&magic[0], magic.size()) || magic != PACK_MAGIC)
+        return false;
+    in.seekg(0, std::ios::end);
+    off_t size = in.tellg();
+    if (size < (off_t) (magic.size() + PACK_TRAILER_LEN))
+        return false;
+    std::string trailer(PACK_TRAILER_LEN, '\0');
+    in.seekg(size - PACK_TRAILER_LEN);
+    if (! in.read(&trailer[0], trailer.size()) ||
+            trailer.substr(20) != PACK_TRAILER)
+        return false;
+    off_t indexAt = strtoll(trailer.c_str(), 0, 10);
+    if (indexAt < (off_t) magic.size() ||
+            indexAt > size - (off_t) PACK_TRAILER_LEN)
+        return false;
+    in.seekg(indexAt);
+    std::string index(size - PACK_TRAILER_LEN - indexAt, '\0');
+    if (! in.read(&index[0], index.size()))
+        return false;
+    // Every member must lie between the header and the index.
+    std::istringstream lines(index);
+    PackMember m;
+    std::vector<PackMember> found;
+    while (lines >> m.offset >> m.length >> m.name) {
+        if (m.offset < (off_t) magic.size() || m.length < 0 ||
+                m.length > indexAt - m.offset)
+            return false;
+        found.push_back(m);
+    }
+    members.insert(members.end(), found.begin(), found.end());
+    return true;
+}
+
+bool read_journal(const std::string& journal, std::set<std::string>& done) {
+    std::ifstream in(journal);
+    if (! in)
+        return false;
+    std::string line;
+    while (std::getline(in, line))
+        if (! line.empty())
+            done.insert(line);
+    return true;
+}
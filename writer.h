@@ -0,0 +1,145 @@
+/**************************************************************************
+ *                                                                        *
+ *  sort-census, a census sorting tool for Regina                         *
+ *                                                                        *
+ *  Copyright (c) 1999-2016, William Pettersson                           *
+ *  For further details contact william@ewpettersson.se.                  *
+ *                                                                        *
+ *  This program is free software; you can redistribute it and/or         *
+ *  modify it under the terms of the GNU General Public License as        *
+ *  published by the Free Software Foundation; either version 2 of the    *
+ *  License, or (at your option) any later version.                       *
+ *                                                                        *
+ *  As an exception, when this program is distributed through (i) the     *
+ *  App Store by Apple Inc.; (ii) the Mac App Store by Apple Inc.; or     *
+ *  (iii) Google Play by Google Inc., then that store may impose any      *
+ *  digital rights management, device limits and/or redistribution        *
+ *  restrictions that are required by its terms of service.               *
+ *                                                                        *
+ *  This program is distributed in the hope that it will be useful, but   *
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of            *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU     *
+ *  General Public License for more details.                              *
+ *                                                                        *
+ *  You should have received a copy of the GNU General Public             *
+ *  License along with this program; if not, write to the Free            *
+ *  Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,       *
+ *  MA 02110-1301, USA.                                                   *
+ *                                                                        *
+ **************************************************************************/
+
+
+#ifndef _WRITER_H
+#define _WRITER_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <set>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Writes output files on a dedicated thread, so that workers can hand over a
+ * fully formatted file and go straight back to computing.
+ *
+ * At most maxQueued bytes of output are held in memory at once; write() will
+ * block until the writer thread has caught up enough to make room.
+ *
+ * Each file is written to a temporary file, synced to disk and then renamed
+ * into place, so a file either has its old contents or its complete new
+ * contents. Files whose contents would not change are left untouched, and
+ * the name of every file that did change is printed on standard output.
+ *
+ * If a journal is given, complete() appends a line to it once every file
+ * queued before that call is safely on disk. Each file belongs to a unit of
+ * work, and a unit is never journalled if any of its files could not be
+ * written, so that it is done again when resuming.
+ *
+ * If a pack is given, files are instead stored as members of that one pack
+ * file (see below), named by the last component of their path. The pack is
+ * only renamed into place, and the journal only updated, when the Writer is
+ * destroyed.
+ */
+class Writer {
+    public:
+        // If journal is non-empty, completed work units are appended to that
+        // file. The journal is truncated first unless append is true.
+        Writer(size_t maxQueued, const std::string& journal = "",
+                bool append = false, const std::string& pack = "");
+        ~Writer();
+
+        // Queue data to be written to the file fname, replacing anything
+        // already there, as part of the given unit of work.
+        void write(const std::string& fname, std::string data,
+                const std::string& unit);
+
+        // Record unit in the journal once everything queued so far has
+        // been written, unless some file in unit could not be written.
+        void complete(const std::string& unit);
+
+    private:
+        void run();
+        // Returns false if the file could not be written.
+        bool writeFile(const std::string& fname, const std::string& data);
+        void writeJournal(const std::string& unit);
+        void finishPack();
+        void changed(const std::string& fname);
+
+        struct Job {
+            std::string fname;
+            std::string data;
+            std::string unit;
+            bool journal;
+        };
+        std::queue<Job> jobs;
+        int journalFd;
+        // Units with a file that could not be written.
+        std::set<std::string> failed;
+        // Directories holding files renamed since the last journal entry.
+        std::set<std::string> dirty;
+
+        std::string pack;
+        int packFd;
+        off_t packSize;
+        std::string packIndex;
+        std::set<std::string> packMembers;
+        // Units completed since the pack was started.
+        std::vector<std::string> deferred;
+
+        size_t nChanged;
+        size_t unchanged;
+
+        size_t queued;
+        size_t maxQueued;
+        std::mutex queue_mutex;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        bool stop;
+        std::thread thread;
+};
+
+// Read the units recorded in journal into done. Returns false if the journal
+// could not be read.
+bool read_journal(const std::string& journal, std::set<std::string>& done);
+
+/**
+ * A pack holds many small output files in one file. It starts with a line
+ * "SORTCENSUS-PACK 1", followed by the contents of each member in turn. Then
+ * comes an index, with a line "<offset> <length> <name>" for each member, and
+ * finally a fixed-width trailer giving the offset of the index.
+ */
+struct PackMember {
+    std::string name;
+    off_t offset;
+    off_t length;
+};
+
+// Read the index of pack into members. Returns false if pack could not be
+// read or is not a pack.
+bool read_pack_index(const std::string& pack, std::vector<PackMember>& members);
+
+#endif // _WRITER_H